@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../header/Base64.hpp"
+
+/**
+ * Compares the base64 codec against the byte at a time implementation the server used before.
+ * Run with an optional payload size in MiB, default 8.
+ */
+
+static const std::string legacy_chars =
+             "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+             "abcdefghijklmnopqrstuvwxyz"
+             "0123456789+/";
+
+/**
+ * @brief The previous decoder, a lookup table built per call and one push_back per byte
+ */
+static std::vector<unsigned char> legacy_decode(const std::string &in) {
+    std::vector<int> T(256, -1);
+    for (int i = 0; i < 64; i++) T[legacy_chars[i]] = i;
+
+    std::vector<unsigned char> out;
+    int val = 0, valb = -8;
+
+    for (unsigned char c : in) {
+        if (c == '=') break;
+        if (T[c] == -1) continue;
+
+        val = (val << 6) + T[c];
+        valb += 6;
+        if (valb >= 0) {
+            out.push_back(static_cast<unsigned char>((val >> valb) & 0xFF));
+            valb -= 8;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief The previous encoder, appending one character at a time
+ */
+static std::string legacy_encode(const unsigned char* bytes_to_encode, unsigned int in_len) {
+    std::string ret;
+    int i = 0;
+    int j = 0;
+    unsigned char char_array_3[3];
+    unsigned char char_array_4[4];
+
+    while (in_len--) {
+        char_array_3[i++] = *(bytes_to_encode++);
+        if (i == 3) {
+            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+            char_array_4[3] = char_array_3[2] & 0x3f;
+
+            for (i = 0; i < 4; i++)
+                ret += legacy_chars[char_array_4[i]];
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j < 3; j++)
+            char_array_3[j] = '\0';
+
+        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+        char_array_4[3] = char_array_3[2] & 0x3f;
+
+        for (j = 0; j < i + 1; j++)
+            ret += legacy_chars[char_array_4[j]];
+
+        while (i++ < 3)
+            ret += '=';
+    }
+
+    return ret;
+}
+
+template <typename F>
+static double timeMs(F &&f, int runs) {
+    double best = 1e300;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    const size_t mib = argc > 1 ? std::stoul(argv[1]) : 8;
+    const size_t size = mib << 20;
+    const int runs = 5;
+
+    std::mt19937 rng(42);
+    std::vector<unsigned char> data(size);
+    for (auto &byte : data) byte = static_cast<unsigned char>(rng());
+
+    const std::string encoded = legacy_encode(data.data(), data.size());
+    if (base64_encode(data.data(), data.size()) != encoded || base64_decode(encoded) != data) {
+        std::cerr << "codec output differs from the legacy implementation" << std::endl;
+        return 1;
+    }
+
+    size_t sink = 0;
+    const double legacyEncode = timeMs([&] { sink += legacy_encode(data.data(), data.size()).size(); }, runs);
+    const double encode = timeMs([&] { sink += base64_encode(data.data(), data.size()).size(); }, runs);
+    const double legacyDecode = timeMs([&] { sink += legacy_decode(encoded).size(); }, runs);
+    const double decode = timeMs([&] { sink += base64_decode(encoded).size(); }, runs);
+    std::string scratch;
+    const double inplace = timeMs([&] {
+        scratch = encoded;
+        sink += base64_decode_inplace(&scratch[0], scratch.size());
+    }, runs);
+
+    auto rate = [&](double ms) { return mib / (ms / 1000.0); };
+    std::cout << "instruction set: " << base64_instruction_set() << ", payload " << mib << " MiB" << std::endl;
+    std::cout << "encode  legacy " << legacyEncode << " ms (" << rate(legacyEncode) << " MiB/s), new "
+              << encode << " ms (" << rate(encode) << " MiB/s)" << std::endl;
+    std::cout << "decode  legacy " << legacyDecode << " ms (" << rate(legacyDecode) << " MiB/s), new "
+              << decode << " ms (" << rate(decode) << " MiB/s)" << std::endl;
+    std::cout << "decode  in place, including the copy " << inplace << " ms" << std::endl;
+    return sink == 0;
+}
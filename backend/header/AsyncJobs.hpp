@@ -0,0 +1,116 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Thrown by AsyncJob::checkCancelled to stop the work of a cancelled job
+ */
+class AsyncJobCancelled : public std::runtime_error {
+  public:
+    AsyncJobCancelled() : std::runtime_error("Job was cancelled") {}
+};
+
+/**
+ * @brief A model generation that runs in the background
+ * Holds the progress and the finished models of one job. The work reads the request
+ * first and sets its colors and format, then adds models one color at a time, and
+ * clients can read the status and every finished model while the job is still running.
+ * All functions are safe to call from several threads.
+ */
+class AsyncJob {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State { Queued, Running, Done, Failed, Cancelled };
+
+    struct Model {
+        std::string color;
+        std::string data;
+    };
+
+    struct Status {
+        State state;
+        size_t modelsDone;
+        size_t modelsTotal;
+        std::string error;
+    };
+
+    explicit AsyncJob(std::string id);
+
+    const std::string &getId() const { return id; }
+    std::vector<std::string> getColors() const;
+    std::string getFormat() const;
+    Status getStatus() const;
+    const Model *getModel(size_t index) const;
+    bool isFinished() const;
+    Clock::time_point getFinishedAt() const;
+    size_t getBytes() const;
+    std::vector<std::string> getOverBudget() const;
+
+    void cancel();
+    void checkCancelled() const;
+
+    void setRunning();
+    void setRequest(std::vector<std::string> colors, std::string format);
+    void addModel(const std::string &color, std::string data);
+    void setOverBudget(std::vector<std::string> colors);
+    void setDone();
+    void setFailed(const std::string &error);
+    void setCancelled();
+
+    static const char *stateName(State state);
+
+  private:
+    const std::string id;
+
+    mutable std::mutex mutex;
+    std::vector<std::string> colors;
+    std::string format;
+    State state = State::Queued;
+    std::vector<Model> models;
+    size_t bytes = 0;
+    std::vector<std::string> overBudget;
+    std::string error;
+    bool cancelRequested = false;
+    Clock::time_point finishedAt;
+
+    void finish(State finalState);
+};
+
+/**
+ * @brief Starts background jobs and keeps them until their results expire
+ * The jobs run on an executor, a function that takes a task and returns false if it
+ * cannot take more work. The server passes its JobScheduler, a test harness can pass
+ * an executor that keeps the tasks and runs them when it wants to.
+ * Finished jobs are dropped when they have been finished for the time to live, or when
+ * the models of all jobs take more than the memory cap, oldest finished job first.
+ * Running jobs are never dropped, so they may take the registry over its cap for a while.
+ */
+class AsyncJobRegistry {
+  public:
+    using Executor = std::function<bool(std::function<void()>)>;
+    using Work = std::function<void(AsyncJob &)>;
+
+    AsyncJobRegistry(Executor executor, std::chrono::seconds ttl, size_t capBytes);
+    std::shared_ptr<AsyncJob> submit(Work work);
+    std::shared_ptr<AsyncJob> find(const std::string &id);
+    bool remove(const std::string &id);
+    size_t getJobs() const;
+    size_t getBytes() const;
+
+  private:
+    Executor executor;
+    std::chrono::seconds ttl;
+    size_t capBytes;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<AsyncJob>> jobs;
+
+    void evict();
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Get the length of the base64 encoding of some bytes
+ * @param len The number of bytes
+ * @return The number of base64 characters, including padding
+ */
+constexpr size_t base64_encoded_size(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+/**
+ * @brief Encodes bytes to a base64 string
+ * @param bytes The bytes that are encoded
+ * @param len The number of bytes
+ * @return The base64 string
+ */
+std::string base64_encode(const unsigned char* bytes, size_t len);
+
+/**
+ * @brief Appends bytes as base64 to a string
+ * The string is grown once to its final size before encoding.
+ * @param out The string to append to
+ * @param bytes The bytes that are encoded
+ * @param len The number of bytes
+ */
+void base64_append(std::string &out, const unsigned char* bytes, size_t len);
+
+/**
+ * @brief Decodes a Base64 encoded string
+ * Characters that are not part of the base64 alphabet are skipped,
+ * and decoding stops at the first '='.
+ * @param in The Base64 encoded string to decode.
+ * @return The decoded bytes.
+ */
+std::vector<unsigned char> base64_decode(const std::string &in);
+
+/**
+ * @brief Decodes Base64 in place
+ * The decoded bytes are written over the start of the buffer, which works because
+ * the output is never longer than the input read so far. Follows the same rules as base64_decode.
+ * @param data The buffer holding the base64 characters
+ * @param len The number of characters
+ * @return The number of decoded bytes at the start of the buffer
+ */
+size_t base64_decode_inplace(char* data, size_t len);
+
+/**
+ * @brief Get the name of the instruction set the codec uses
+ * @return avx2, ssse3 or scalar
+ */
+const char* base64_instruction_set();
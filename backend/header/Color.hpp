@@ -1,6 +1,9 @@
 #pragma once
 #include <string>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
 
   /**
    * @brief HSL representation of a color
@@ -36,19 +39,84 @@ int toNum(const std::string &hex);
  */
 int setInLimits(int num, int min, int max);
 
+/**
+ * @brief Calculate the distance between two hsl colors
+ * Hue is weighted the most, then saturation and lightness.
+ * @param a The first color
+ * @param b The second color
+ * @return the distance (scaled to be comparable with RGB distance)
+ */
+int hslDistance(const HSL &a, const HSL &b);
+
+/**
+ * @brief A packed rgba color
+ * Stores a color in a single 32 bit value (0xAARRGGBB) so it can be copied and compared
+ * without allocating. Used on the per pixel paths, the hexadecimal string is only
+ * built when it is asked for.
+ */
+struct PackedColor {
+  uint32_t value;
+
+  constexpr PackedColor() : value(0xFF000000) {}
+  constexpr PackedColor(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha = 255)
+    : value((uint32_t(alpha) << 24) | (uint32_t(red) << 16) | (uint32_t(green) << 8) | uint32_t(blue)) {}
+
+  /**
+   * @brief Create a packed color from a pixel in opencv channel order
+   * @param bgra pointer to the blue, green, red and alpha bytes of the pixel
+   * @return The packed color
+   */
+  static constexpr PackedColor fromBgra(const uint8_t *bgra) {
+    return PackedColor(bgra[2], bgra[1], bgra[0], bgra[3]);
+  }
+
+  constexpr uint8_t red() const { return (value >> 16) & 0xFF; }
+  constexpr uint8_t green() const { return (value >> 8) & 0xFF; }
+  constexpr uint8_t blue() const { return value & 0xFF; }
+  constexpr uint8_t alpha() const { return value >> 24; }
+  /**
+   * @brief The color without alpha, usable as an index into a 2^24 table
+   */
+  constexpr uint32_t rgb() const { return value & 0xFFFFFF; }
+
+  /**
+   * @brief Format the color as #RRGGBB
+   * @return The characters of the hexadecimal string
+   */
+  constexpr std::array<char, 7> hexChars() const {
+    constexpr char digits[] = "0123456789ABCDEF";
+    return {'#',
+            digits[red() >> 4], digits[red() & 0xF],
+            digits[green() >> 4], digits[green() & 0xF],
+            digits[blue() >> 4], digits[blue() & 0xF]};
+  }
+  std::string hex() const {
+    const std::array<char, 7> chars = hexChars();
+    return std::string(chars.data(), chars.size());
+  }
+
+  constexpr bool operator==(const PackedColor &color) const { return value == color.value; }
+  constexpr bool operator!=(const PackedColor &color) const { return value != color.value; }
+};
+
+static_assert(std::is_trivially_copyable<PackedColor>::value, "PackedColor must stay trivially copyable");
+
 /**
  * @brief A class to represent a color
- * A class to represent a color with red, green, and blue values and a hexadecimal string.
+ * A class to represent a color with red, green, and blue values.
+ * The hexadecimal string is built on demand.
  */
 class Color {
   public:
   Color();
   Color(int red, int green, int blue);
   explicit Color(const std::string& hex);
+  explicit Color(PackedColor color);
   int getRed() const;
   int getGreen() const;
   int getBlue() const;
   std::string getHex() const;
+  PackedColor getPacked() const;
   void setRed(int red);
   void setGreen(int green);
   void setBlue(int blue);
@@ -60,6 +128,7 @@ class Color {
   int getDistance(const std::string &color) const;
   int getHslDistance(const Color &color) const;
   int getHslDistance(const std::string &color) const;
+  HSL rgbToHsl() const;
   
   int operator==(const Color &color) const {
     return red == color.red && green == color.green && blue == color.blue;
@@ -81,7 +150,4 @@ class Color {
   int red;
   int green;
   int blue;
-  std::string hex;
-
-  HSL rgbToHsl() const;
 };
@@ -1,7 +1,54 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include "Color.hpp"
+#include "PaletteKernel.hpp"
+
+/**
+ * @brief A lazily filled table from rgb values to the closest palette color
+ * Holds one entry for every 24 bit rgb value. An entry is resolved the first time
+ * it is looked up and reused after that, so every distinct color in an image is only
+ * compared against the palette once. Lookups are safe to do from several threads.
+ * The table is split into 64 KiB pages by the red channel, and a page is only allocated
+ * once one of its colors is resolved, so an image with few colors keeps it small.
+ * Entries that are not resolved yet are found in batches with the PaletteKernel in rgb mode.
+ * In hsl mode the palette is converted to hsl once, so every new color only needs
+ * one conversion of its own.
+ */
+class PaletteLookup {
+  public:
+    PaletteLookup(const std::vector<Color>& colors, bool hsl);
+    ~PaletteLookup();
+    int getClosestIndex(PackedColor color) const;
+    void getClosestIndices(const PackedColor *pixels, int *indices, size_t count) const;
+    size_t getTableBytes() const { return tableBytes.load(std::memory_order_relaxed); }
+
+    static std::shared_ptr<const PaletteLookup> forPalette(const std::vector<Color>& colors, bool hsl);
+    static void setCacheSize(size_t size);
+    static size_t getCachedLookups();
+    static size_t getCacheBytes();
+
+    static constexpr size_t maxColors = 255;
+
+  private:
+    static constexpr size_t pageCount = 1 << 8;
+    static constexpr size_t pageSize = 1 << 16;
+
+    std::vector<Color> colors;
+    std::vector<PackedColor> packed;
+    std::vector<HSL> hslColors;
+    bool hsl;
+    std::unique_ptr<std::atomic<std::atomic<uint8_t> *>[]> pages;
+    mutable std::atomic<size_t> tableBytes{0};
+    std::unique_ptr<PaletteKernel> kernel;
+
+    std::atomic<uint8_t> *findPage(uint32_t rgb) const;
+    std::atomic<uint8_t> &entry(uint32_t rgb) const;
+    int findClosestIndex(PackedColor color) const;
+};
 
 /**
  * @brief A class to map colors to the closest available color
@@ -23,8 +70,15 @@ class ColorMap {
     Color getClosestColor(const std::string &color) const;
     Color getClosestColor(const Color &color, bool hsl) const;
     Color getClosestColor(const std::string &color, bool hsl) const;
+    int getClosestIndex(const Color &color, bool hsl) const;
+    int getClosestIndex(PackedColor color, bool hsl) const;
+    void getClosestIndices(const PackedColor *pixels, int *indices, size_t count, bool hsl) const;
 
 
   private:
     std::vector<Color> colors;
+    mutable std::shared_ptr<const PaletteLookup> lookups[2];
+
+    std::shared_ptr<const PaletteLookup> getLookup(bool hsl) const;
+    void resetLookups();
 };
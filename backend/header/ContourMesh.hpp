@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Decimate.hpp"
+#include "LabelImage.hpp"
+#include "Mesh.hpp"
+#include "Triangulate.hpp"
+
+/**
+ * @brief A class that meshes a label from the outlines of its regions
+ * An alternative to MarchingSquare for large flat areas. The same contour that marching
+ * squares follows is traced as closed loops, one outer loop and any number of holes per
+ * 8-connected region. The loops are simplified with Douglas-Peucker without letting the
+ * loops of a region cross, the top and bottom of a region are triangulated from its loops
+ * with triangulatePolygon, and the side walls
+ * are extruded from the loops. The mesh therefore grows with the length and detail of the
+ * outlines, not with the area of the regions.
+ *
+ * Loop corners are kept in the doubled grid of MarchingSquare, so the mesh has the same
+ * size and position as the marched one. Pixels outside the label grid count as empty,
+ * so regions that touch its edge are closed too. Regions are simplified on their own, so
+ * neighboring regions can overlap by up to the tolerance.
+ */
+class ContourMesh {
+  public:
+    ContourMesh(const LabelView &labels, uint8_t label, double tolerance = 0);
+    void traceContours();
+    size_t decimate(const DecimateOptions &options);
+    std::string getMeshString();
+    std::string getMeshBinary() const;
+    const Mesh &getMesh() const { return mesh; }
+
+  private:
+    int width;
+    int height;
+    int paddedWidth;
+    int paddedHeight;
+    float size;
+    double tolerance;
+    Mesh mesh;
+
+    std::vector<uint8_t> occupancy;
+
+    /**
+     * @brief A closed loop of the contour, with the inside on its right in the grid
+     */
+    struct Loop {
+        std::vector<GridPoint> points;
+        int64_t area2;
+    };
+
+    int cellIndex(int x, int y) const;
+    void traceLoop(int cellX, int cellY, int side, std::vector<uint8_t> &visited, Loop &loop) const;
+    uint8_t &visitedEdge(std::vector<uint8_t> &visited, int cellX, int cellY, int side) const;
+    void simplify(std::vector<Loop> &loops) const;
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <limits>
+#include "Mesh.hpp"
+
+// the models have two units per pixel
+static constexpr double unitsPerPixel = 2.0;
+// the default error tolerance, an eighth of a pixel in model units
+static constexpr double defaultMaxError = 0.125 * unitsPerPixel;
+
+/**
+ * @brief The limits of a decimation
+ * @param maxTriangles Collapsing stops once the mesh has at most this many triangles, 0 for no budget
+ * @param maxError The largest error a collapse may add, as a distance in model units.
+ * The error of a collapse is the root mean square distance of the new vertex to the
+ * planes of the faces around it, so flat areas and straight edges collapse for free.
+ * The default keeps the outline and walls within an eighth of a pixel of where they were, so a
+ * budget that is too small leaves more triangles instead of eating into the shape.
+ */
+struct DecimateOptions {
+    size_t maxTriangles = 0;
+    double maxError = defaultMaxError;
+};
+
+/**
+ * @brief Reduce the triangles of a mesh with quadric error edge collapses
+ * Every vertex gets the quadric of the planes of its faces. Edges are collapsed
+ * cheapest first from a heap until the triangle budget is met or the next collapse
+ * would exceed the error tolerance. A collapse is skipped if it would make the mesh
+ * non-manifold (link condition), flip a face or leave a face with an angle near 0 or
+ * 180 degrees. New positions are rounded to float first, as the mesh stores them.
+ *
+ * Open boundaries and sharp edges, like the outline where the top of an extrusion
+ * meets its walls, get heavily weighted planes along them, so they move far less than
+ * flat areas before a collapse reaches the error tolerance. Open boundaries are never pinched, so a closed mesh
+ * stays closed and an open one keeps its holes.
+ * @param mesh The mesh to decimate, its unused vertices are dropped
+ * @param options The triangle budget and error tolerance, with no budget and an infinite tolerance the mesh is not changed
+ * @return The number of triangles that were removed
+ */
+size_t decimateMesh(Mesh &mesh, const DecimateOptions &options);
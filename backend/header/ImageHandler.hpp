@@ -3,6 +3,7 @@
 #include <string>
 #include "Color.hpp"
 #include "ColorMap.hpp"
+#include "LabelImage.hpp"
 
 using namespace cv;
 
@@ -20,6 +21,19 @@ void colorToPixel(const Color &color, Vec4b &pixel);
  * @return The color
  */
 Color pixelToColor(const Vec4b &pixel);
+/**
+ * @brief Convert a pixel to a packed color
+ * @param pixel The pixel to convert
+ * @return The packed color
+ */
+PackedColor pixelToPacked(const Vec4b &pixel);
+
+/**
+ * @brief The ways blurImage can smooth an image
+ * Bilateral is the reference edge-preserving blur, its cost grows with the kernel size.
+ * Guided is a self-guided filter made of box filters, its cost does not depend on the kernel size.
+ */
+enum class BlurMode { Bilateral, Guided };
 
 /**
  * @brief  A class to handle image reading writing and processing
@@ -31,18 +45,22 @@ class ImageHandler {
     explicit ImageHandler(const std::string &path);
     void readImage(const std::string &path);
     void setImage(const Mat &img);
+    void setWorkingImage(Mat &img);
     void saveImage(const std::string &path);
     void mapImage(const ColorMap &colorMap);
     void mapImage(const ColorMap &colorMap, bool hsl);
     void mapImage(ColorMap &colorMap, const std::string &path);
-    void blurImage(int kernelSize);
-    void removeIslands(int islandSize);
+    void blurImage(int kernelSize, int colorSize, BlurMode mode = BlurMode::Bilateral);
+    size_t removeIslands(const ColorMap &colorMap, int minIslandSize);
     void downScaleImage(int maxSize);
     Mat getImage() const { return outputImage; }
     Matrix getImageAsMatrix(const Color &color);
+    LabelImage getLabelImage(const ColorMap &colorMap);
 
 
   private:
+    static LabelImage labelPixels(const Mat &source, const std::vector<Color> &colors);
+
     Mat image;
     Mat outputImage;
     ColorMap *colorMapPtr{};
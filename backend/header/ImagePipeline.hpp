@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "ImageHandler.hpp"
+#include "MatCache.hpp"
+
+/**
+ * @brief The stages of the preprocessing pipeline, in the order they run
+ * The values are also the stage of the cache keys of their results.
+ */
+enum class PipelineStage { Decode, Downscale, Blur, Map, Cleanup };
+
+/**
+ * @brief The settings of a pipeline run
+ * @param colors The palette to map to
+ * @param hsl If mapping should use hsl distance
+ * @param blurFactor The blur kernel size on the source image, 0 for no blur
+ * @param blurMode The filter to blur with
+ * @param maxSize The largest side after downscaling, 0 for no downscaling
+ * @param minIslandSize The smallest island kept after mapping, 0 to keep every island
+ */
+struct PipelineSettings {
+    std::vector<std::string> colors;
+    bool hsl = false;
+    int blurFactor = 0;
+    BlurMode blurMode = BlurMode::Bilateral;
+    int maxSize = 1024;
+    int minIslandSize = 0;
+};
+
+/**
+ * @brief Turns a decoded image into a mapped preview
+ * The stages run in the order of PipelineStage. Downscaling comes before blurring
+ * because it is the only stage that changes the size, so every later stage works on
+ * as few pixels as possible; the blur kernel is scaled down with the image while its
+ * color range is not, so the preview looks the same as when the full image is blurred. After the first copy
+ * every stage works in place on one buffer. The downscaled and blurred images are
+ * cached, so a request that only changes the palette starts at the map stage.
+ */
+class ImagePipeline {
+  public:
+    static constexpr std::array<PipelineStage, 5> order = {
+        PipelineStage::Decode, PipelineStage::Downscale, PipelineStage::Blur, PipelineStage::Map, PipelineStage::Cleanup
+    };
+
+    ImagePipeline(MatCache &cache, PipelineSettings settings);
+
+    std::vector<PipelineStage> plan(const cv::Size &size) const;
+    cv::Mat run(const cv::Mat &decoded, const ContentHash &content) const;
+
+    static const char *stageName(PipelineStage stage);
+
+  private:
+    MatCache &cache;
+    PipelineSettings settings;
+
+    double downscaleFactor(const cv::Size &size) const;
+    int scaledBlurSize(double scale) const;
+};
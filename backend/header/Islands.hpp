@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "LabelImage.hpp"
+
+/**
+ * @brief The 4-connected or 8-connected components of a label image
+ * Every pixel gets the id of its component. Ids are numbered from 0 in the order the
+ * components are first met when scanning row by row.
+ */
+struct Components {
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> sizes;
+    std::vector<uint8_t> labels;
+
+    uint32_t at(int x, int y) const { return ids[static_cast<size_t>(y) * width + x]; }
+    size_t count() const { return sizes.size(); }
+};
+
+/**
+ * @brief Find the connected components of a label image
+ * Two-pass union-find: strips of rows are labelled in parallel, then the components
+ * that touch across the strip borders are merged and the ids are flattened.
+ * @param labels The label image
+ * @param diagonal If pixels that only touch at a corner are connected too
+ * @return The components, including the ones of label 0
+ */
+Components findComponents(const LabelView &labels, bool diagonal = false);
+
+/**
+ * @brief Merge small islands into the color around them
+ * An island is a component of a non-zero label with fewer than minIslandSize pixels.
+ * It takes the label it shares the longest border with, counting only neighbors that
+ * are not islands themselves when there are any. Transparent neighbors (label 0) are
+ * never taken, so an island surrounded only by transparency is kept.
+ * @param labels The label image to change
+ * @param minIslandSize The smallest island that is kept, 0 or 1 keeps everything
+ * @return The number of islands that were merged
+ */
+size_t removeIslands(LabelImage &labels, int minIslandSize);
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Runs heavy jobs on a fixed number of worker threads
+ * Jobs wait in a bounded queue. When the queue is full a job is refused instead of
+ * queued, so the caller can tell the client to come back later. Every job runs with a
+ * thread budget, which its parallel loops use to split their work (see ThreadBudget.hpp),
+ * so concurrent jobs share the OpenCV thread pool instead of each asking for all of it.
+ */
+class JobScheduler {
+  public:
+    JobScheduler(int workers, size_t queueCapacity, int threadsPerJob);
+    ~JobScheduler();
+    JobScheduler(const JobScheduler &) = delete;
+    JobScheduler &operator=(const JobScheduler &) = delete;
+
+    bool trySubmit(std::function<void()> job);
+    std::chrono::seconds getRetryAfter() const;
+
+    int getWorkers() const { return static_cast<int>(threads.size()); }
+    int getThreadsPerJob() const { return threadsPerJob; }
+    size_t getQueueCapacity() const { return capacity; }
+    size_t getQueued() const;
+    int getRunning() const;
+    uint64_t getRejected() const { return rejected.load(std::memory_order_relaxed); }
+
+  private:
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::function<void()>> queue;
+    std::vector<std::thread> threads;
+    size_t capacity;
+    int threadsPerJob;
+    int running = 0;
+    bool stopping = false;
+    double averageSeconds = 1.0;
+    std::atomic<uint64_t> rejected{0};
+
+    void work();
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief An image where every pixel holds the label of its palette color
+ * Label 0 means the pixel is transparent or has none of the palette colors,
+ * label i + 1 means the pixel has palette color i. Like the matrices used for
+ * marching squares, the image has a border of empty pixels on every side, so
+ * width and height are two larger than the source image.
+ */
+struct LabelImage {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> labels;
+
+    static constexpr int maxLabels = 255;
+
+    LabelImage() = default;
+    LabelImage(int width, int height) : width(width), height(height), labels(static_cast<size_t>(width) * height, 0) {}
+
+    uint8_t at(int x, int y) const { return labels[static_cast<size_t>(y) * width + x]; }
+    uint8_t *row(int y) { return labels.data() + static_cast<size_t>(y) * width; }
+    const uint8_t *row(int y) const { return labels.data() + static_cast<size_t>(y) * width; }
+};
+
+/**
+ * @brief A non-owning view of a grid of labels
+ * Points into a label image, or any other row-major byte buffer, without copying it.
+ * The buffer has to outlive the view.
+ */
+struct LabelView {
+    const uint8_t *data = nullptr;
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;
+
+    LabelView() = default;
+    LabelView(const uint8_t *data, int width, int height, size_t stride) : data(data), width(width), height(height), stride(stride) {}
+    LabelView(const LabelImage &image) : data(image.labels.data()), width(image.width), height(image.height), stride(image.width) {}
+
+    uint8_t at(int x, int y) const { return data[y * stride + x]; }
+    const uint8_t *row(int y) const { return data + y * stride; }
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class LogLevel { Debug, Info, Warning, Error, Off };
+
+/**
+ * @brief A leveled logger that writes on a background thread
+ * Messages go into a fixed size ring buffer and a flusher thread writes them to stdout
+ * in batches, so logging threads never wait on the console. When the buffer is full,
+ * new messages are dropped and counted instead of blocking. Use the LOG_ macros: they
+ * check the level first, so the arguments of a disabled level are not even evaluated.
+ * Only log short messages; request and response bodies are never logged.
+ */
+class Logger {
+  public:
+    explicit Logger(size_t capacity = 4096);
+    ~Logger();
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    bool enabled(LogLevel level) const { return level >= this->level.load(std::memory_order_relaxed); }
+    void setLevel(LogLevel level) { this->level.store(level, std::memory_order_relaxed); }
+    LogLevel getLevel() const { return level.load(std::memory_order_relaxed); }
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+    void write(LogLevel level, std::string message);
+    void flush();
+
+    template <typename... Args>
+    void log(LogLevel level, const Args &...args) {
+        std::ostringstream message;
+        (message << ... << args);
+        write(level, message.str());
+    }
+
+    static const char *levelName(LogLevel level);
+    static std::optional<LogLevel> parseLevel(const std::string &name);
+
+  private:
+    std::atomic<LogLevel> level{LogLevel::Info};
+    std::atomic<uint64_t> dropped{0};
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::vector<std::string> ring;
+    size_t head = 0;
+    size_t count = 0;
+    uint64_t written = 0;
+    uint64_t queued = 0;
+    bool stopping = false;
+    std::thread flusher;
+
+    void run();
+};
+
+/**
+ * @brief Get the logger of the process
+ */
+Logger &logger();
+
+#define COLORMAP_LOG(level, ...) \
+    do { \
+        if (logger().enabled(level)) logger().log(level, __VA_ARGS__); \
+    } while (0)
+
+#define LOG_DEBUG(...) COLORMAP_LOG(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...) COLORMAP_LOG(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARNING(...) COLORMAP_LOG(LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) COLORMAP_LOG(LogLevel::Error, __VA_ARGS__)
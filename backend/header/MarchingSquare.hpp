@@ -1,5 +1,7 @@
 #pragma once
 #include "Mesh.hpp"
+#include "LabelImage.hpp"
+#include "Decimate.hpp"
 #include <array>
 #include <vector>
 #include <cmath>
@@ -88,31 +90,86 @@ const vector<vector<vector<Tri>>> sideFaceLookup = {
     {} // 1111
 };
 
+/**
+ * @brief A rectangle of cells with the same lookup index that is meshed as one piece
+ * Either full cells, or a strip of half cells (index 0011, 1100, 0110 or 1001) along a
+ * straight edge, whose top and bottom are half a cell wide and whose side is one wall quad.
+ * The corners of the cells are in doubled grid coordinates. The faces are fanned from
+ * the corner fanCorner, counted clockwise from the top left, or from the center vertex
+ * if no corner can see the whole outline.
+ */
+struct MergedRect {
+    int x0, y0, x1, y1;
+    int index = 15;
+    int fanCorner = -1;
+    int32_t center = -1;
+
+    array<int, 4> face() const {
+        switch (index) {
+            case 3: return {x0, y0, x1, y0 + 1};
+            case 12: return {x0, y1 - 1, x1, y1};
+            case 6: return {x1 - 1, y0, x1, y1};
+            case 9: return {x0, y0, x0 + 1, y1};
+            default: return {x0, y0, x1, y1};
+        }
+    }
+};
+
 /**
  * @brief A class that uses marching squares to make a mesh
- * A class hat takes a matrix with 0s and 1s, and uses marching squares 
- * to make a mesh based on the matrix values.
+ * A class hat takes a matrix with 0s and 1s, or a view of a label grid and the
+ * label to use, and uses marching squares to make a mesh based on the values.
+ *
+ * The grid is kept as a flat row-major byte occupancy grid. Vertex references are
+ * kept in one flat array over the doubled grid, holding the index of the bottom
+ * vertex; the top vertex is always created right after it.
+ *
+ * Marching is done in bands of rows in parallel. The band size is fixed, so the
+ * mesh is identical no matter how many threads run.
+ *
+ * With mergeFaces, the full cells of every band are greedily merged into rectangles,
+ * and runs of half cells along straight horizontal or vertical edges into strips with
+ * a single wall. The outline of a rectangle holds every vertex that a neighbor uses on
+ * its border, so the mesh stays watertight without T-junctions, and points inside a
+ * rectangle or along a straight wall get no vertex at all.
  */
 class MarchingSquare{
     public:
-    MarchingSquare(Matrix matrix, int w, int h);
+    MarchingSquare(const Matrix &matrix, int w, int h);
+    MarchingSquare(const LabelView &labels, uint8_t label, bool mergeFaces = false);
     void marchSquares();
+    size_t decimate(const DecimateOptions &options);
     void exportMesh(string &filename);
     string getMeshString();
+    string getMeshBinary() const;
+    const Mesh &getMesh() const { return mesh; }
+
+    static constexpr int bandRows = 64;
 
     private:
     int width;
     int height;
-    Matrix m;
+    int gridWidth;
+    float size;
     Mesh mesh;
 
-    vector<vector<vector<int>>> vertRef;
+    bool mergeFaces = false;
 
-    int indexFromMatrix(int startX, int startY);
+    vector<uint8_t> occupancy;
+    vector<int32_t> vertRef;
+    vector<vector<MergedRect>> rects;
+    vector<uint8_t> mergedCells;
+
+    int indexFromMatrix(int startX, int startY) const;
     void vertsFromMatrix();
 
-    void addVertsFromSquare(int startX, int startY, float size);
-    void marchSquare(int startX, int startY);
+    void useVert(int x, int y, int firstGridRow, vector<uint8_t> &used, vector<size_t> &created) const;
+    void addVertsFromSquare(int startX, int startY, int firstGridRow, vector<uint8_t> &used, vector<size_t> &created) const;
+    void marchSquare(int startX, int startY, vector<Face> &faces) const;
+
+    void findRects(int firstRow, int lastRow, vector<MergedRect> &bandRects, uint8_t *covered) const;
+    void rectOutline(const MergedRect &rect, vector<int32_t> &outline, array<size_t, 4> &corners) const;
+    void marchRect(const MergedRect &rect, vector<Face> &faces, vector<int32_t> &outline) const;
 
 
 };
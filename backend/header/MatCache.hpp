@@ -0,0 +1,72 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <opencv2/core.hpp>
+
+/**
+ * @brief The 128 bit BLAKE2b hash of an uploaded file
+ */
+using ContentHash = std::array<uint64_t, 2>;
+
+/**
+ * @brief The key of a cached image
+ * An image is identified by the hash of the uploaded file, the processing stage
+ * it was taken from and the parameters that went into that stage.
+ */
+struct MatCacheKey {
+    ContentHash content{};
+    int stage = 0;
+    std::array<int, 3> params{};
+
+    bool operator==(const MatCacheKey &other) const {
+        return content == other.content && stage == other.stage && params == other.params;
+    }
+};
+
+/**
+ * @brief A least recently used cache of images with a memory budget
+ * Cached images are shared, not copied, so they must not be written to after
+ * they are put in the cache or taken out of it; clone them first.
+ * All functions are safe to call from several threads.
+ */
+class MatCache {
+  public:
+    explicit MatCache(size_t budgetBytes);
+    bool get(const MatCacheKey &key, cv::Mat &image);
+    void put(const MatCacheKey &key, const cv::Mat &image);
+    void clear();
+    void setBudget(size_t budgetBytes);
+
+    size_t getBudget() const;
+    size_t getBytes() const;
+    size_t getEntries() const;
+    uint64_t getHits() const { return hits.load(std::memory_order_relaxed); }
+    uint64_t getMisses() const { return misses.load(std::memory_order_relaxed); }
+
+    static ContentHash hashBytes(const void *data, size_t size);
+
+  private:
+    struct KeyHash {
+        size_t operator()(const MatCacheKey &key) const;
+    };
+    struct Entry {
+        MatCacheKey key;
+        cv::Mat image;
+        size_t bytes;
+    };
+
+    mutable std::mutex mutex;
+    std::list<Entry> entries;
+    std::unordered_map<MatCacheKey, std::list<Entry>::iterator, KeyHash> index;
+    size_t budget;
+    size_t bytes = 0;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+
+    void evict();
+};
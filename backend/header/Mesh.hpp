@@ -26,16 +26,24 @@ struct Face {
  * @brief A class to represent a 3D mesh
  * A class to represent a 3D mesh with vertices and faces. 
  * It has functions for adding vertices, adding faces, clearing the mesh, 
- * and exporting to STL format.
+ * and exporting to ASCII or binary STL format. The indexed formats, binary PLY, OBJ
+ * and the mesh of a 3MF object, are written straight from the vertex and face arrays,
+ * so every vertex is stored once.
  */
 class Mesh {
 public:
     Mesh();
     int addVertex(float x, float y, float z);
     void addFace(int v1, int v2, int v3);
+    void addFaces(const std::vector<Face>& newFaces);
     void clear();
     bool exportSTL(const std::string& filename);
-    std::string toString();
+    std::string toString() const;
+    bool exportBinarySTL(const std::string& filename) const;
+    std::string toBinarySTL() const;
+    std::string toBinaryPLY() const;
+    std::string toOBJ() const;
+    std::string to3MFMesh() const;
 
     const std::vector<Vertex>& getVertices() const { return vertices; }
     const std::vector<Face>& getFaces() const { return faces; }
@@ -43,5 +51,5 @@ public:
 private:
     std::vector<Vertex> vertices;
     std::vector<Face> faces;
-    Vertex computeNormal(const Face& f);
+    Vertex computeNormal(const Face& f) const;
 };
@@ -0,0 +1,108 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief A latency histogram that can be updated from many threads without locks
+ * Every observation increments one bucket counter and the sum, both atomics.
+ */
+class Histogram {
+  public:
+    static constexpr std::array<double, 16> bounds = {
+        0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+        0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0
+    };
+
+    struct Snapshot {
+        std::array<uint64_t, bounds.size() + 1> buckets;
+        uint64_t count;
+        double sum;
+    };
+
+    void observe(double seconds);
+    Snapshot snapshot() const;
+
+  private:
+    std::array<std::atomic<uint64_t>, bounds.size() + 1> buckets{};
+    std::atomic<uint64_t> sumNanos{0};
+};
+
+/**
+ * @brief The processing stages that are timed
+ */
+enum class Stage {
+    Base64Decode,
+    ImageDecode,
+    Blur,
+    Downscale,
+    Map,
+    Islands,
+    PngEncode,
+    Label,
+    March,
+    Decimate,
+    Serialize,
+    ResponseEncode,
+    Count
+};
+
+/**
+ * @brief The counters of one endpoint
+ */
+struct RequestMetrics {
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    Histogram latency;
+};
+
+/**
+ * @brief The metrics of the server
+ * Stage histograms are fixed, endpoints are registered once when the routes are made
+ * and updated without locks after that. render writes everything in the Prometheus text format.
+ */
+class Metrics {
+  public:
+    Histogram &stage(Stage stage) { return stages[static_cast<size_t>(stage)]; }
+    RequestMetrics &endpoint(const std::string &name);
+    std::string render() const;
+
+    static const char *stageName(Stage stage);
+
+  private:
+    std::array<Histogram, static_cast<size_t>(Stage::Count)> stages;
+    mutable std::mutex mutex;
+    std::map<std::string, std::unique_ptr<RequestMetrics>> endpoints;
+};
+
+/**
+ * @brief Get the metrics of the process
+ */
+Metrics &metrics();
+
+/**
+ * @brief Times a stage from construction to destruction
+ */
+class ScopedTimer {
+  public:
+    explicit ScopedTimer(Stage stage) : ScopedTimer(metrics().stage(stage)) {}
+    explicit ScopedTimer(Histogram &histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        histogram.observe(elapsed.count());
+    }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  private:
+    Histogram &histogram;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A part of a multipart/form-data body
+ * The data points into the request body and is not copied, so the body has to outlive the part.
+ */
+struct MultipartPart {
+    std::string name;
+    std::string filename;
+    std::string contentType;
+    std::string_view data;
+};
+
+/**
+ * @brief Get the boundary of a multipart content type
+ * @param contentType The value of the Content-Type header
+ * @return The boundary, empty if the content type is not multipart/form-data
+ */
+std::string getMultipartBoundary(const std::string &contentType);
+
+/**
+ * @brief Splits a multipart/form-data body into its parts
+ * @param body The request body
+ * @param boundary The boundary from the content type
+ * @return The parts, in body order
+ * @throws invalid_argument If the body is not valid multipart data
+ */
+std::vector<MultipartPart> parseMultipart(std::string_view body, const std::string &boundary);
+
+/**
+ * @brief Finds a part by its form field name
+ * @param parts The parts of the body
+ * @param name The field name
+ * @return The part, or nullptr if there is no part with that name
+ */
+const MultipartPart *findMultipartPart(const std::vector<MultipartPart> &parts, const std::string &name);
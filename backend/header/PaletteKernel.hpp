@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Color.hpp"
+
+/**
+ * @brief A vectorized nearest color search over a palette
+ * Keeps the palette in structure of arrays form and compares blocks of pixels
+ * against every palette color at once. The instruction set (AVX-512, AVX2, SSE4.1
+ * or plain scalar code) is picked at runtime.
+ *
+ * The result is the same as Color::getDistance based searching: the truncated
+ * distance is compared, and on equal distance the color with the lowest hex wins.
+ * Both are folded into one integer score, (distance << 8) | rank, where rank is the
+ * position of the color when the palette is sorted by hex.
+ */
+class PaletteKernel {
+  public:
+    explicit PaletteKernel(const std::vector<PackedColor>& palette);
+    void findClosest(const PackedColor *pixels, int *indices, size_t count) const;
+    const char *getInstructionSet() const { return instructionSet; }
+
+    static constexpr size_t maxColors = 255;
+
+  private:
+    using KernelFunction = void (*)(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count);
+
+    std::vector<int32_t> reds;
+    std::vector<int32_t> greens;
+    std::vector<int32_t> blues;
+    std::vector<int32_t> ranks;
+    std::vector<int> rankToIndex;
+    KernelFunction kernel;
+    const char *instructionSet;
+
+    static void scoreScalar(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count);
+    static void scoreSse41(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count);
+    static void scoreAvx2(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count);
+    static void scoreAvx512(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count);
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <string>
+
+/**
+ * @brief Makes a random 128 bit id as 32 hex digits
+ * Used for handles and job ids that clients should not be able to guess, so every
+ * bit comes from the system's secure random source and never from a seeded generator.
+ * @return The id
+ * @throws system_error If the random device cannot be read
+ */
+inline std::string makeRandomId() {
+    static const char digits[] = "0123456789abcdef";
+    std::random_device device;
+    std::string id(32, '0');
+    for (int word = 0; word < 4; word++) {
+        uint32_t bits = device();
+        for (int i = 0; i < 8; i++) {
+            id[word * 8 + i] = digits[bits & 0xF];
+            bits >>= 4;
+        }
+    }
+    return id;
+}
@@ -1,18 +1,37 @@
+#include <chrono>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
 #define CROW_USE_BOOST_ASIO
 #include "crow.h"
 #include <nlohmann/json.hpp>
 #include <opencv2/opencv.hpp>
+#include "MatCache.hpp"
+#include "SessionStore.hpp"
+#include "JobScheduler.hpp"
+#include "AsyncJobs.hpp"
+#include "Logger.hpp"
 
 // CORS middleware
 struct CORS {
     struct context {};
 
+    // admin routes that browsers on other origins must not reach
+    static bool isPrivate(const crow::request &req) { return req.url == "/api/log_level"; }
+
+    // the raw endpoints take their options as headers, which a browser only sends when they are allowed
+    static constexpr const char *allowedHeaders =
+        "Content-Type, X-Colors, X-Format, X-Merge-Faces, X-Max-Triangles, X-Mesh-Mode, X-Contour-Tolerance, "
+        "X-Remove-Islands, X-Min-Island-Size, X-Blur-Factor, X-Blur-Mode, X-Max-Size, X-Method, X-Image-Handle";
+    // response headers a browser client may read, besides the few that are always readable
+    static constexpr const char *exposedHeaders = "Retry-After, Content-Disposition, X-Over-Budget";
+
     void before_handle(crow::request& req, crow::response& res, context&) {
+        if (isPrivate(req)) return;
         res.add_header("Access-Control-Allow-Origin", "*");
-        res.add_header("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
-        res.add_header("Access-Control-Allow-Headers", "Content-Type");
+        res.add_header("Access-Control-Allow-Methods", "GET, POST, DELETE, OPTIONS");
+        res.add_header("Access-Control-Allow-Headers", allowedHeaders);
 
         // Handle preflight (OPTIONS) request immediately
         if (req.method == crow::HTTPMethod::Options) {
@@ -21,13 +40,63 @@ struct CORS {
         }
     }
 
-    void after_handle(crow::request&, crow::response& res, context&) {
+    void after_handle(crow::request& req, crow::response& res, context&) {
+        if (isPrivate(req)) return;
         // Add headers again (important for non-OPTIONS responses)
         res.add_header("Access-Control-Allow-Origin", "*");
-        res.add_header("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
-        res.add_header("Access-Control-Allow-Headers", "Content-Type");
+        res.add_header("Access-Control-Allow-Methods", "GET, POST, DELETE, OPTIONS");
+        res.add_header("Access-Control-Allow-Headers", allowedHeaders);
+        res.add_header("Access-Control-Expose-Headers", exposedHeaders);
     }
 };
+/**
+ * @brief The settings of a server
+ * @param cacheBytes The memory budget of the cache of decoded and preprocessed images
+ * @param sessionBytes The memory cap of the uploaded images kept under a handle
+ * @param sessionTtl How long an uploaded image is kept after it was last used
+ * @param workers The number of heavy requests that are processed at the same time
+ * @param queueCapacity The number of heavy requests that may wait, more are answered with 503
+ * @param threadsPerJob The threads one request may use, 0 to share the cores evenly between the workers
+ * @param jobTtl How long the models of a finished async job are kept
+ * @param jobBytes The memory cap of the models of async jobs, the oldest finished jobs are dropped first
+ * @param paletteCacheSize The number of palettes whose color lookup table is kept between requests, up to 16 MiB each
+ * @param logLevel The lowest level that is logged
+ * @param logLevelControl If the level can be changed at runtime with a POST to /api/log_level
+ */
+struct ServerOptions {
+    size_t cacheBytes = size_t(256) << 20;
+    size_t sessionBytes = size_t(512) << 20;
+    std::chrono::seconds sessionTtl{30 * 60};
+    int workers = 2;
+    size_t queueCapacity = 8;
+    int threadsPerJob = 0;
+    std::chrono::seconds jobTtl{10 * 60};
+    size_t jobBytes = size_t(512) << 20;
+    size_t paletteCacheSize = 4;
+    LogLevel logLevel = LogLevel::Info;
+    bool logLevelControl = false;
+};
+
+/**
+ * @brief The sending side of a stream websocket
+ * Crow deletes a connection right after its close handler ran, while a job may still be
+ * making models for it. The job sends through the peer, which drops the messages once
+ * the connection is gone.
+ */
+class StreamPeer {
+  public:
+    explicit StreamPeer(crow::websocket::connection &connection) : connection(&connection) {}
+    void send(std::string &&text);
+    void detach();
+    bool isOpen();
+    size_t bytesSent();
+
+  private:
+    std::mutex mutex;
+    crow::websocket::connection *connection;
+    size_t sent = 0;
+};
+
 /**
  * @brief A class to represent a server
  * A class to represent a server that handles image processing requests.
@@ -35,18 +104,36 @@ struct CORS {
 
 class Server {
 public:
-    explicit Server(int port);
+    explicit Server(int port, const ServerOptions &options = ServerOptions());
     void start();
     void stop();
     crow::response handleImageProcessingRequest(const std::string &request);
+    bool handleImageProcessingStream(const std::string &request, StreamPeer &peer);
     crow::response handleColorMapRequest(const std::string &request);
+    crow::response handleRawImageProcessingRequest(const crow::request &req);
+    crow::response handleRawColorMapRequest(const crow::request &req);
+    crow::response handleUploadRequest(const crow::request &req);
+    crow::response handleJobSubmitRequest(const crow::request &req);
+    crow::response handleJobStatusRequest(const std::string &id);
+    crow::response handleJobModelsRequest(const std::string &id);
+    crow::response handleJobModelRequest(const std::string &id, int index);
+    crow::response handleMetricsRequest();
+    crow::response handleLogLevelRequest(const crow::request &req);
 
 private:
     int port;
     bool running;
+    bool logLevelControl;
     crow::App<CORS> colorMapServer;
+    MatCache imageCache;
+    SessionStore sessions;
+    AsyncJobRegistry asyncJobs;
+    // declared last, so it finishes its jobs before the caches they use are destroyed
+    JobScheduler scheduler;
     std::vector<std::string> getColorsFromMappingRequest(const std::string &request) const;
     bool isValidFileFormat(const std::string &fileFormat) const;
+    crow::response runJob(const std::function<crow::response()> &job);
+    crow::response busyResponse() const;
 
 
 
@@ -0,0 +1,59 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <opencv2/core.hpp>
+#include "MatCache.hpp"
+
+/**
+ * @brief A decoded upload and the hash of the uploaded file
+ * The hash identifies the image in the MatCache.
+ */
+struct UploadedImage {
+    cv::Mat image;
+    ContentHash content{};
+};
+
+/**
+ * @brief Keeps uploaded images on the server under a handle
+ * A client uploads an image once and refers to it by its handle in later requests.
+ * An image is dropped when it has not been used for the time to live, or when the
+ * store is over its memory cap, least recently used first. Stored images are shared
+ * and must not be written to. All functions are safe to call from several threads.
+ */
+class SessionStore {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    SessionStore(size_t capBytes, std::chrono::seconds ttl);
+    std::string put(const UploadedImage &upload);
+    std::optional<UploadedImage> get(const std::string &handle);
+    bool remove(const std::string &handle);
+
+    std::chrono::seconds getTtl() const { return ttl; }
+    size_t getBytes() const;
+    size_t getSessions() const;
+
+  private:
+    struct Session {
+        std::string handle;
+        UploadedImage upload;
+        size_t bytes;
+        Clock::time_point lastUsed;
+    };
+
+    mutable std::mutex mutex;
+    std::list<Session> sessions;
+    std::unordered_map<std::string, std::list<Session>::iterator> index;
+    size_t capBytes;
+    std::chrono::seconds ttl;
+    size_t bytes = 0;
+
+    std::string newHandle();
+    void evict(Clock::time_point now);
+};
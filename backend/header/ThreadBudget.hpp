@@ -0,0 +1,36 @@
+#pragma once
+#include <algorithm>
+
+/**
+ * @brief The number of threads the parallel loops on this thread may use
+ * Set by the JobScheduler for the jobs it runs, 0 means no limit.
+ * Parallel loops pass parallelStripes() to cv::parallel_for_, which splits their
+ * range into that many stripes, so at most that many pool threads work on them.
+ */
+inline thread_local int threadBudget = 0;
+
+/**
+ * @brief Get the number of stripes for a parallel loop
+ * @param maxStripes The most stripes the loop wants, -1 if it leaves that to OpenCV
+ * @return The stripes to pass to cv::parallel_for_
+ */
+inline double parallelStripes(double maxStripes = -1) {
+    if (threadBudget <= 0) {
+        return maxStripes;
+    }
+    return maxStripes > 0 ? std::min<double>(maxStripes, threadBudget) : threadBudget;
+}
+
+/**
+ * @brief Sets the thread budget of the current thread for its lifetime
+ */
+class ScopedThreadBudget {
+  public:
+    explicit ScopedThreadBudget(int threads) : previous(threadBudget) { threadBudget = threads; }
+    ~ScopedThreadBudget() { threadBudget = previous; }
+    ScopedThreadBudget(const ScopedThreadBudget &) = delete;
+    ScopedThreadBudget &operator=(const ScopedThreadBudget &) = delete;
+
+  private:
+    int previous;
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * @brief One object of a 3MF package
+ */
+struct ThreeMFObject {
+    // the color of the object as #RRGGBB, also used as its name
+    std::string color;
+    // the mesh element of the object, from Mesh::to3MFMesh
+    std::string mesh;
+};
+
+/**
+ * @brief Packs objects into one 3MF file
+ * Every object gets its color as a base material and one build item, so a slicer
+ * imports all colors of a print in one step. Objects without a mesh are left out.
+ * The package is a zip file with the model, the content types and the relationships,
+ * deflated with zlib.
+ * @param objects the objects, in the order they are listed in the model
+ * @return the bytes of the 3MF file
+ * @throws invalid_argument if a color is not a hex color
+ * @throws runtime_error if deflating fails or a part is too large for a zip file without zip64
+ */
+std::string make3MFPackage(const std::vector<ThreeMFObject> &objects);
@@ -0,0 +1,27 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief A corner of a polygon on an integer grid
+ */
+using GridPoint = std::array<int32_t, 2>;
+
+/**
+ * @brief Triangulate a polygon with holes with a sweep line
+ * A sweep from top to bottom splits the polygon into y-monotone pieces, which are then
+ * triangulated from top to bottom with a stack. Holes are handled by the sweep like any
+ * other ring, so the time is O(n log n) no matter how many holes there are.
+ *
+ * The coordinates are integers, so every orientation test is exact. The rings must not
+ * touch or cross each other or themselves, and coordinates must stay below 2^20.
+ * Every corner of the rings is kept, so the edges of the triangles match the rings.
+ * @param points The corners of all rings, one ring after the other
+ * @param ringStarts The index of the first corner of every ring. The first ring is the
+ * outer one, the others are holes. Rings are reoriented as needed.
+ * @param triangles Output, the triangles as indices into points, counter clockwise
+ * with the y axis pointing up
+ */
+void triangulatePolygon(const std::vector<GridPoint> &points, const std::vector<uint32_t> &ringStarts,
+                        std::vector<std::array<uint32_t, 3>> &triangles);
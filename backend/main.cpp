@@ -1,4 +1,6 @@
+#include <cstdlib>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <vector>
 #include "header/ColorMap.hpp"
@@ -10,7 +12,44 @@
 using namespace std;
 
 int main() {
-  Server server(8080);
+  // memory limits are set in MiB, the time to live of uploaded images in seconds
+  ServerOptions options;
+  if (const char *cacheMb = std::getenv("COLORMAP_CACHE_MB")) {
+    options.cacheBytes = static_cast<size_t>(std::stoull(cacheMb)) << 20;
+  }
+  if (const char *sessionMb = std::getenv("COLORMAP_SESSION_MB")) {
+    options.sessionBytes = static_cast<size_t>(std::stoull(sessionMb)) << 20;
+  }
+  if (const char *sessionTtl = std::getenv("COLORMAP_SESSION_TTL")) {
+    options.sessionTtl = std::chrono::seconds(std::stoll(sessionTtl));
+  }
+  if (const char *workers = std::getenv("COLORMAP_WORKERS")) {
+    options.workers = std::stoi(workers);
+  }
+  if (const char *queue = std::getenv("COLORMAP_QUEUE")) {
+    options.queueCapacity = static_cast<size_t>(std::stoul(queue));
+  }
+  if (const char *threads = std::getenv("COLORMAP_THREADS_PER_JOB")) {
+    options.threadsPerJob = std::stoi(threads);
+  }
+  if (const char *jobTtl = std::getenv("COLORMAP_JOB_TTL")) {
+    options.jobTtl = std::chrono::seconds(std::stoll(jobTtl));
+  }
+  if (const char *jobMb = std::getenv("COLORMAP_JOB_MB")) {
+    options.jobBytes = static_cast<size_t>(std::stoull(jobMb)) << 20;
+  }
+  if (const char *paletteCache = std::getenv("COLORMAP_PALETTE_CACHE")) {
+    options.paletteCacheSize = static_cast<size_t>(std::stoul(paletteCache));
+  }
+  if (const char *control = std::getenv("COLORMAP_LOG_LEVEL_CONTROL")) {
+    options.logLevelControl = std::string(control) == "1";
+  }
+  if (const char *logLevel = std::getenv("COLORMAP_LOG_LEVEL")) {
+    if (std::optional<LogLevel> level = Logger::parseLevel(logLevel)) {
+      options.logLevel = *level;
+    }
+  }
+  Server server(8080, options);
   server.start();
 
 
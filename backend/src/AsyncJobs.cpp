@@ -0,0 +1,286 @@
+#include "../header/AsyncJobs.hpp"
+#include <algorithm>
+#include "../header/RandomId.hpp"
+
+/**
+ * @brief Constructor of a job
+ * @param id The id clients use to find the job
+ */
+AsyncJob::AsyncJob(std::string id) : id(std::move(id)) {}
+
+/**
+ * @brief Get the colors a model is made for, empty until the work has read the request
+ */
+std::vector<std::string> AsyncJob::getColors() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return colors;
+}
+
+/**
+ * @brief Get the format of the models, empty until the work has read the request
+ */
+std::string AsyncJob::getFormat() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return format;
+}
+
+AsyncJob::Status AsyncJob::getStatus() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {state, models.size(), colors.size(), error};
+}
+
+/**
+ * @brief Get a finished model
+ * @param index The index of the color of the model
+ * @return The model, or nullptr if it is not finished yet
+ */
+const AsyncJob::Model *AsyncJob::getModel(size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index < models.size() ? &models[index] : nullptr;
+}
+
+bool AsyncJob::isFinished() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return state != State::Queued && state != State::Running;
+}
+
+AsyncJob::Clock::time_point AsyncJob::getFinishedAt() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return finishedAt;
+}
+
+/**
+ * @brief Get the memory the models of the job take
+ */
+size_t AsyncJob::getBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+/**
+ * @brief Get the colors whose model stayed over the triangle budget
+ */
+std::vector<std::string> AsyncJob::getOverBudget() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return overBudget;
+}
+
+/**
+ * @brief Ask the job to stop
+ * A queued job does not start, a running job stops after the model it is working on.
+ */
+void AsyncJob::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cancelRequested = true;
+}
+
+/**
+ * @brief Called by the work between models
+ * @throws AsyncJobCancelled If the job was cancelled
+ */
+void AsyncJob::checkCancelled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cancelRequested) {
+        throw AsyncJobCancelled();
+    }
+}
+
+void AsyncJob::setRunning() {
+    std::lock_guard<std::mutex> lock(mutex);
+    state = State::Running;
+}
+
+/**
+ * @brief Set what the job makes, once the work has read the request
+ * @param colors The colors a model is made for, in order
+ * @param format The format of the models
+ * @throws logic_error If the job already has models
+ */
+void AsyncJob::setRequest(std::vector<std::string> colors, std::string format) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!models.empty()) {
+        throw std::logic_error("Job already has models");
+    }
+    this->colors = std::move(colors);
+    this->format = std::move(format);
+    // models never move once added, so getModel can hand out pointers to them
+    models.reserve(this->colors.size());
+}
+
+/**
+ * @brief Add the next finished model
+ * @param color The color of the model
+ * @param data The model file
+ * @throws logic_error If the job already has a model for every color
+ */
+void AsyncJob::addModel(const std::string &color, std::string data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (models.size() == colors.size()) {
+        throw std::logic_error("Job has more models than colors");
+    }
+    bytes += color.size() + data.size();
+    models.push_back({color, std::move(data)});
+}
+
+void AsyncJob::setOverBudget(std::vector<std::string> colors) {
+    std::lock_guard<std::mutex> lock(mutex);
+    overBudget = std::move(colors);
+}
+
+void AsyncJob::setDone() {
+    finish(State::Done);
+}
+
+void AsyncJob::setFailed(const std::string &message) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = message;
+    }
+    finish(State::Failed);
+}
+
+void AsyncJob::setCancelled() {
+    finish(State::Cancelled);
+}
+
+void AsyncJob::finish(State finalState) {
+    std::lock_guard<std::mutex> lock(mutex);
+    state = finalState;
+    finishedAt = Clock::now();
+}
+
+/**
+ * @brief Get the name of a state as used in the api
+ */
+const char *AsyncJob::stateName(State state) {
+    switch (state) {
+        case State::Queued: return "queued";
+        case State::Running: return "running";
+        case State::Done: return "done";
+        case State::Failed: return "failed";
+        case State::Cancelled: return "cancelled";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Constructor of the registry
+ * @param executor Runs the jobs, returns false if it cannot take another one
+ * @param ttl How long a finished job is kept
+ * @param capBytes The most memory the models of all jobs may take before finished jobs are dropped
+ */
+AsyncJobRegistry::AsyncJobRegistry(Executor executor, std::chrono::seconds ttl, size_t capBytes)
+    : executor(std::move(executor)), ttl(ttl), capBytes(capBytes) {}
+
+/**
+ * @brief Start a job
+ * @param work Reads the request, sets it on the job and adds the models to it
+ * @return The job, or nullptr if the executor did not take it
+ */
+std::shared_ptr<AsyncJob> AsyncJobRegistry::submit(Work work) {
+    std::shared_ptr<AsyncJob> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        evict();
+        std::string id;
+        do {
+            id = makeRandomId();
+        } while (jobs.count(id));
+        job = std::make_shared<AsyncJob>(id);
+        jobs[id] = job;
+    }
+
+    // the registry outlives the executor, which finishes its tasks first
+    const bool accepted = executor([this, job, work = std::move(work)]() {
+        try {
+            job->checkCancelled();
+            job->setRunning();
+            work(*job);
+            job->setDone();
+        } catch (const AsyncJobCancelled &) {
+            job->setCancelled();
+        } catch (const std::exception &e) {
+            job->setFailed(e.what());
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        evict();
+    });
+    if (!accepted) {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.erase(job->getId());
+        return nullptr;
+    }
+    return job;
+}
+
+/**
+ * @brief Find a job by its id
+ * @return The job, or nullptr if the id is unknown or the job expired
+ */
+std::shared_ptr<AsyncJob> AsyncJobRegistry::find(const std::string &id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    evict();
+    auto it = jobs.find(id);
+    return it == jobs.end() ? nullptr : it->second;
+}
+
+/**
+ * @brief Cancel a job and forget it
+ * @return True if the id was known
+ */
+bool AsyncJobRegistry::remove(const std::string &id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) {
+        return false;
+    }
+    it->second->cancel();
+    jobs.erase(it);
+    return true;
+}
+
+size_t AsyncJobRegistry::getJobs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return jobs.size();
+}
+
+size_t AsyncJobRegistry::getBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const auto &entry : jobs) {
+        bytes += entry.second->getBytes();
+    }
+    return bytes;
+}
+
+/**
+ * @brief Drops jobs that have been finished for longer than the time to live and, while
+ * over the memory cap, the oldest finished ones, the lock must be held
+ */
+void AsyncJobRegistry::evict() {
+    const AsyncJob::Clock::time_point now = AsyncJob::Clock::now();
+    size_t bytes = 0;
+    std::vector<std::pair<AsyncJob::Clock::time_point, std::string>> finished;
+    for (auto it = jobs.begin(); it != jobs.end();) {
+        const AsyncJob &job = *it->second;
+        if (job.isFinished() && now - job.getFinishedAt() > ttl) {
+            it = jobs.erase(it);
+            continue;
+        }
+        bytes += job.getBytes();
+        if (job.isFinished()) {
+            finished.emplace_back(job.getFinishedAt(), it->first);
+        }
+        ++it;
+    }
+    if (bytes <= capBytes) {
+        return;
+    }
+    std::sort(finished.begin(), finished.end());
+    for (const auto &entry : finished) {
+        if (bytes <= capBytes) break;
+        auto it = jobs.find(entry.second);
+        bytes -= it->second->getBytes();
+        jobs.erase(it);
+    }
+}
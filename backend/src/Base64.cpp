@@ -0,0 +1,311 @@
+#include "../header/Base64.hpp"
+#include <array>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+static const char base64_chars[] =
+             "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+             "abcdefghijklmnopqrstuvwxyz"
+             "0123456789+/";
+
+/**
+ * @brief Builds the table from characters to their 6 bit values, -1 for characters outside the alphabet
+ */
+static constexpr std::array<int8_t, 256> makeDecodeTable() {
+    std::array<int8_t, 256> table{};
+    for (int i = 0; i < 256; i++) table[i] = -1;
+    for (int i = 0; i < 64; i++) table[static_cast<unsigned char>(base64_chars[i])] = static_cast<int8_t>(i);
+    return table;
+}
+
+static constexpr std::array<int8_t, 256> decodeTable = makeDecodeTable();
+
+/**
+ * @brief The block functions of one instruction set
+ * encodeBlocks encodes as many whole blocks as it can and returns the number of bytes used,
+ * a multiple of 3. decodeBlocks decodes whole blocks until it meets a character outside the
+ * alphabet and returns the number of characters used, a multiple of 4. It may write up to
+ * 16 bytes past its output, but never past the input it has read, so it works in place.
+ */
+struct Base64Codec {
+    size_t (*encodeBlocks)(const unsigned char* in, size_t len, char* out);
+    size_t (*decodeBlocks)(const char* in, size_t len, unsigned char* out);
+    const char* name;
+};
+
+static size_t encodeBlocksScalar(const unsigned char*, size_t, char*) {
+    return 0;
+}
+
+static size_t decodeBlocksScalar(const char*, size_t, unsigned char*) {
+    return 0;
+}
+
+#ifdef BASE64_X86
+
+/**
+ * @brief Spreads 12 bytes into 16 bytes holding one 6 bit value each
+ * Each group of 3 bytes is shuffled to [b1 b0 b2 b1] and the 6 bit fields are moved in place with multiplies.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i encodeIndices(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+/**
+ * @brief Turns 6 bit values into base64 characters by adding a per range offset
+ */
+__attribute__((target("ssse3")))
+static inline __m128i encodeChars(__m128i indices) {
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+__attribute__((target("ssse3")))
+static size_t encodeBlocksSsse3(const unsigned char* in, size_t len, char* out) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 12) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encodeChars(encodeIndices(bytes)));
+        out += 16;
+    }
+    return i;
+}
+
+/**
+ * @brief Validates 16 characters and turns them into 6 bit values
+ * @return false if any character is outside the alphabet
+ */
+__attribute__((target("ssse3")))
+static inline bool decodeValues(__m128i &str) {
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), nibble);
+    const __m128i loNibbles = _mm_and_si128(str, nibble);
+    const __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, loNibbles), _mm_shuffle_epi8(lutHi, hiNibbles));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xFFFF) {
+        return false;
+    }
+    const __m128i isSlash = _mm_cmpeq_epi8(str, _mm_set1_epi8('/'));
+    str = _mm_add_epi8(str, _mm_shuffle_epi8(lutRoll, _mm_add_epi8(isSlash, hiNibbles)));
+    return true;
+}
+
+/**
+ * @brief Packs 16 6 bit values into 12 bytes at the start of the register
+ */
+__attribute__((target("ssse3")))
+static inline __m128i decodePack(__m128i values) {
+    const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static size_t decodeBlocksSsse3(const char* in, size_t len, unsigned char* out) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        if (!decodeValues(str)) break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), decodePack(str));
+        out += 12;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t encodeBlocksAvx2(const unsigned char* in, size_t len, char* out) {
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                             1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    for (; i + 28 <= len; i += 24) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+        __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        bytes = _mm256_shuffle_epi8(bytes, shuffle);
+        const __m256i t0 = _mm256_and_si256(bytes, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(bytes, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), chars);
+        out += 32;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t decodeBlocksAvx2(const char* in, size_t len, unsigned char* out) {
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), nibble);
+        const __m256i loNibbles = _mm256_and_si256(str, nibble);
+        const __m256i invalid = _mm256_and_si256(_mm256_shuffle_epi8(lutLo, loNibbles), _mm256_shuffle_epi8(lutHi, hiNibbles));
+        if (!_mm256_testz_si256(invalid, invalid)) break;
+
+        const __m256i isSlash = _mm256_cmpeq_epi8(str, _mm256_set1_epi8('/'));
+        str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(isSlash, hiNibbles)));
+        const __m256i pairs = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        const __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        const __m256i bytes = _mm256_shuffle_epi8(words, pack);
+        // the low lane first, the high lane then overwrites its 4 unused bytes
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(bytes));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm256_extracti128_si256(bytes, 1));
+        out += 24;
+    }
+    // a block of 16 may still fit, or be valid when the block of 32 was not
+    return i + decodeBlocksSsse3(in + i, len - i, out);
+}
+
+#endif
+
+/**
+ * @brief Picks the widest instruction set the cpu supports
+ */
+static Base64Codec pickCodec() {
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {encodeBlocksAvx2, decodeBlocksAvx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return {encodeBlocksSsse3, decodeBlocksSsse3, "ssse3"};
+    }
+#endif
+    return {encodeBlocksScalar, decodeBlocksScalar, "scalar"};
+}
+
+static const Base64Codec& codec() {
+    static const Base64Codec picked = pickCodec();
+    return picked;
+}
+
+/**
+ * @brief Encodes bytes into a buffer of exactly base64_encoded_size(len) characters
+ */
+static void encodeInto(const unsigned char* bytes, size_t len, char* out) {
+    size_t i = codec().encodeBlocks(bytes, len, out);
+    out += i / 3 * 4;
+
+    for (; i + 3 <= len; i += 3) {
+        const unsigned int n = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+        *out++ = base64_chars[(n >> 18) & 0x3F];
+        *out++ = base64_chars[(n >> 12) & 0x3F];
+        *out++ = base64_chars[(n >> 6) & 0x3F];
+        *out++ = base64_chars[n & 0x3F];
+    }
+    if (i < len) {
+        const bool two = i + 1 < len;
+        const unsigned int n = (bytes[i] << 16) | (two ? bytes[i + 1] << 8 : 0);
+        *out++ = base64_chars[(n >> 18) & 0x3F];
+        *out++ = base64_chars[(n >> 12) & 0x3F];
+        *out++ = two ? base64_chars[(n >> 6) & 0x3F] : '=';
+        *out++ = '=';
+    }
+}
+
+/**
+ * @brief Decodes characters into out, which may be the same buffer as in
+ * Whole blocks of valid characters are decoded with the vector code, anything
+ * else (line breaks, a data url prefix, the end) one character at a time.
+ * @return The number of decoded bytes
+ */
+static size_t decodeInto(const char* in, size_t len, unsigned char* out) {
+    const Base64Codec &c = codec();
+    size_t i = 0;
+    size_t o = 0;
+    unsigned int val = 0;
+    int valb = -8;
+
+    while (i < len) {
+        if (valb == -8) {
+            const size_t used = c.decodeBlocks(in + i, len - i, out + o);
+            i += used;
+            o += used / 4 * 3;
+            if (i >= len) break;
+        }
+        const unsigned char ch = in[i++];
+        if (ch == '=') break;
+        const int value = decodeTable[ch];
+        if (value < 0) continue;
+
+        val = ((val << 6) | value) & 0xFFFFFF;
+        valb += 6;
+        if (valb >= 0) {
+            out[o++] = static_cast<unsigned char>((val >> valb) & 0xFF);
+            valb -= 8;
+        }
+    }
+    return o;
+}
+
+std::string base64_encode(const unsigned char* bytes, size_t len) {
+    std::string out;
+    base64_append(out, bytes, len);
+    return out;
+}
+
+void base64_append(std::string &out, const unsigned char* bytes, size_t len) {
+    const size_t pos = out.size();
+    // the vector code stores whole registers, so it gets room for one more
+    out.resize(pos + base64_encoded_size(len) + 32);
+    encodeInto(bytes, len, &out[pos]);
+    out.resize(pos + base64_encoded_size(len));
+}
+
+std::vector<unsigned char> base64_decode(const std::string &in) {
+    // the decoded size is at most 3/4 of the input, plus room for one vector store
+    std::vector<unsigned char> out(in.size() / 4 * 3 + 3 + 16);
+    out.resize(decodeInto(in.data(), in.size(), out.data()));
+    return out;
+}
+
+size_t base64_decode_inplace(char* data, size_t len) {
+    return decodeInto(data, len, reinterpret_cast<unsigned char*>(data));
+}
+
+const char* base64_instruction_set() {
+    return codec().name;
+}
@@ -1,5 +1,5 @@
 #include "../header/Color.hpp"
-#include <iostream>
+#include "../header/Logger.hpp"
 #include <string>
 #include <cmath>
 
@@ -72,12 +72,10 @@ Color::Color() {
     red = 0;
     green = 0;
     blue = 0;
-    hex = "#000000";
   }
   /**
    * @brief Constructor with red, green, and blue values
    * Initializes the color with the given red, green, and blue values.
-   * Automatically sets the hexadecimal string.
    * @param red The red value
    * @param green The green value
    * @param blue The blue value
@@ -86,7 +84,6 @@ Color::Color() {
     this->red = red;
     this->green = green;
     this->blue = blue;
-    hex = "#" + toHex(red) + toHex(green) + toHex(blue);
   }
   
   /**
@@ -96,15 +93,24 @@ Color::Color() {
    * @param hex The hexadecimal string
    */
   Color::Color(const std::string& hex) {
-    std::cout << "Creating color from hex: " << hex << std::endl;
     if (hex.length() != 7 || hex[0] != '#') {
       throw std::invalid_argument("Invalid hex color format. Expected format: #RRGGBB");
     }
-    this->hex = hex;
     red = toNum(hex.substr(1, 2));
     green = toNum(hex.substr(3, 2));
     blue = toNum(hex.substr(5, 2));
-    std::cout << "Color created with RGB: (" << red << ", " << green << ", " << blue << ") and hex: " << this->hex << std::endl;
+    LOG_DEBUG("Color created with RGB: (", red, ", ", green, ", ", blue, ") and hex: ", hex);
+  }
+
+  /**
+   * @brief Constructor with a packed color
+   * Initializes the color with the red, green, and blue values of the packed color.
+   * @param color The packed color
+   */
+  Color::Color(const PackedColor color) {
+    red = color.red();
+    green = color.green();
+    blue = color.blue();
   }
   /**
    * @brief Get the red value
@@ -132,7 +138,14 @@ Color::Color() {
    * @return The hexadecimal string
    */
   std::string Color::getHex() const {
-    return hex;
+    return getPacked().hex();
+  }
+  /**
+   * @brief Get the color as a packed value
+   * @return The packed color
+   */
+  PackedColor Color::getPacked() const {
+    return PackedColor(setInLimits(red, 0, 255), setInLimits(green, 0, 255), setInLimits(blue, 0, 255));
   }
   /**
    * @brief Set the red value
@@ -140,7 +153,6 @@ Color::Color() {
    */
   void Color::setRed(const int red) {
     this->red = setInLimits(red, 0, 255);
-    hex = "#" + toHex(red) + toHex(green) + toHex(blue);
   }
   /**
    * @brief Set the green value
@@ -148,7 +160,6 @@ Color::Color() {
    */
   void Color::setGreen(const int green) {
     this->green = setInLimits(green, 0, 255);
-    hex = "#" + toHex(red) + toHex(green) + toHex(blue);
   }
   /**
    * @brief Set the blue value
@@ -156,7 +167,6 @@ Color::Color() {
    */
   void Color::setBlue(const int blue) {
     this->blue = setInLimits(blue, 0, 255);
-    hex = "#" + toHex(red) + toHex(green) + toHex(blue);
   }
   
   /**
@@ -270,9 +280,17 @@ Color::Color() {
  * @return the distance (scaled to be comparable with RGB distance)
  */
 int Color::getHslDistance(const Color &color) const {
-    const HSL& a = rgbToHsl();
-    const HSL& b = color.rgbToHsl();
-    
+    return hslDistance(rgbToHsl(), color.rgbToHsl());
+}
+
+/**
+ * @brief Calculate the distance between two hsl colors
+ * Hue is weighted the most, then saturation and lightness.
+ * @param a The first color
+ * @param b The second color
+ * @return the distance (scaled to be comparable with RGB distance)
+ */
+int hslDistance(const HSL &a, const HSL &b) {
     double dh = std::abs(a.h - b.h);
     dh = std::min(dh, 360.0 - dh) / 180.0;
 
@@ -2,7 +2,253 @@
 #include <vector>
 #include "../header/Color.hpp"
 #include "../header/ColorMap.hpp"
+#include <mutex>
 #include <stdexcept>
+#include <utility>
+
+/**
+ * @brief Constructor of the palette lookup
+ * Sets up the pages of the table when the palette is small enough to be indexed with
+ * a byte, bigger palettes are compared directly on every lookup.
+ * @param colors The palette colors
+ * @param hsl if the lookup should use hsl or rgb distance method
+ */
+PaletteLookup::PaletteLookup(const std::vector<Color>& colors, bool hsl) : colors(colors), hsl(hsl) {
+  for (const auto &color : colors) {
+    packed.push_back(color.getPacked());
+    if (hsl) {
+      hslColors.push_back(color.rgbToHsl());
+    }
+  }
+  if (colors.size() <= maxColors) {
+    pages = std::make_unique<std::atomic<std::atomic<uint8_t> *>[]>(pageCount);
+  }
+  if (!hsl && !packed.empty() && packed.size() <= PaletteKernel::maxColors) {
+    kernel = std::make_unique<PaletteKernel>(packed);
+  }
+}
+
+PaletteLookup::~PaletteLookup() {
+  if (!pages) {
+    return;
+  }
+  for (size_t i = 0; i < pageCount; i++) {
+    delete[] pages[i].load(std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Get the page of the table that holds a color
+ * @param rgb The color
+ * @return The page, nullptr if none of its colors has been resolved yet
+ */
+std::atomic<uint8_t> *PaletteLookup::findPage(uint32_t rgb) const {
+  return pages[rgb >> 16].load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Get the table entry of a color, allocating its page if needed
+ * Two threads may allocate the same page at once, the one that loses frees its copy.
+ * @param rgb The color
+ * @return The entry, 0 if it is not resolved yet, otherwise the index plus one
+ */
+std::atomic<uint8_t> &PaletteLookup::entry(uint32_t rgb) const {
+  std::atomic<std::atomic<uint8_t> *> &slot = pages[rgb >> 16];
+  std::atomic<uint8_t> *page = slot.load(std::memory_order_acquire);
+  if (!page) {
+    auto *fresh = new std::atomic<uint8_t>[pageSize]();
+    if (slot.compare_exchange_strong(page, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      page = fresh;
+      tableBytes.fetch_add(pageSize * sizeof(std::atomic<uint8_t>), std::memory_order_relaxed);
+    } else {
+      delete[] fresh;
+    }
+  }
+  return page[rgb & 0xFFFF];
+}
+
+namespace {
+
+/**
+ * @brief The lookups of the most recently used palettes, most recent first
+ */
+struct LookupCache {
+  std::mutex mutex;
+  std::vector<std::pair<std::string, std::shared_ptr<const PaletteLookup>>> entries;
+  size_t size = 4;
+};
+
+LookupCache &lookupCache() {
+  static LookupCache cache;
+  return cache;
+}
+
+} // namespace
+
+/**
+ * @brief Get the lookup for a palette
+ * Lookups are shared between color maps with the same palette, so the table
+ * filled by one request is reused by the next one with the same colors.
+ * @param colors The palette colors
+ * @param hsl if the lookup should use hsl or rgb distance method
+ * @return The shared lookup
+ */
+std::shared_ptr<const PaletteLookup> PaletteLookup::forPalette(const std::vector<Color>& colors, bool hsl) {
+  std::string key = hsl ? "hsl" : "rgb";
+  for (const auto &color : colors) {
+    key += color.getHex();
+  }
+
+  LookupCache &cache = lookupCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+    if (it->first == key) {
+      auto entry = *it;
+      cache.entries.erase(it);
+      cache.entries.insert(cache.entries.begin(), entry);
+      return entry.second;
+    }
+  }
+  auto lookup = std::make_shared<const PaletteLookup>(colors, hsl);
+  if (cache.size == 0) {
+    return lookup;
+  }
+  cache.entries.insert(cache.entries.begin(), {key, lookup});
+  if (cache.entries.size() > cache.size) {
+    cache.entries.pop_back();
+  }
+  return lookup;
+}
+
+/**
+ * @brief Set how many palettes keep their lookup after their color maps are gone
+ * Each lookup may grow to 16 MiB, as much as an image with every rgb color needs.
+ * @param size The number of lookups, 0 to keep none
+ */
+void PaletteLookup::setCacheSize(size_t size) {
+  LookupCache &cache = lookupCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.size = size;
+  if (cache.entries.size() > size) {
+    cache.entries.resize(size);
+  }
+}
+
+size_t PaletteLookup::getCachedLookups() {
+  LookupCache &cache = lookupCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  return cache.entries.size();
+}
+
+/**
+ * @brief Get the memory the tables of the cached lookups take
+ */
+size_t PaletteLookup::getCacheBytes() {
+  LookupCache &cache = lookupCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  size_t bytes = 0;
+  for (const auto &entry : cache.entries) {
+    bytes += entry.second->getTableBytes();
+  }
+  return bytes;
+}
+
+/**
+ * @brief Get the index of the closest palette color
+ * Uses the table entry if it has been resolved, otherwise resolves and stores it.
+ * @param color The color to compare, alpha is ignored
+ * @return The index of the closest color
+ */
+int PaletteLookup::getClosestIndex(const PackedColor color) const {
+  if (!pages) {
+    return findClosestIndex(color);
+  }
+  std::atomic<uint8_t> &stored = entry(color.rgb());
+  int index = stored.load(std::memory_order_relaxed);
+  if (index == 0) {
+    index = findClosestIndex(color) + 1;
+    stored.store(static_cast<uint8_t>(index), std::memory_order_relaxed);
+  }
+  return index - 1;
+}
+
+/**
+ * @brief Get the index of the closest palette color for a block of pixels
+ * Resolved table entries are read directly, the rest are collected and
+ * resolved together before they are stored in the table.
+ * @param pixels The colors to compare, alpha is ignored
+ * @param indices Output, the index of the closest color for every pixel
+ * @param count The number of pixels
+ */
+void PaletteLookup::getClosestIndices(const PackedColor *pixels, int *indices, size_t count) const {
+  if (!pages) {
+    for (size_t i = 0; i < count; i++) {
+      indices[i] = findClosestIndex(pixels[i]);
+    }
+    return;
+  }
+
+  std::vector<PackedColor> misses;
+  std::vector<size_t> positions;
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t rgb = pixels[i].rgb();
+    const std::atomic<uint8_t> *page = findPage(rgb);
+    const int stored = page ? page[rgb & 0xFFFF].load(std::memory_order_relaxed) : 0;
+    if (stored == 0) {
+      misses.push_back(pixels[i]);
+      positions.push_back(i);
+    } else {
+      indices[i] = stored - 1;
+    }
+  }
+  if (misses.empty()) {
+    return;
+  }
+
+  std::vector<int> resolved(misses.size());
+  if (kernel) {
+    kernel->findClosest(misses.data(), resolved.data(), misses.size());
+  } else {
+    for (size_t i = 0; i < misses.size(); i++) {
+      resolved[i] = findClosestIndex(misses[i]);
+    }
+  }
+  for (size_t i = 0; i < misses.size(); i++) {
+    indices[positions[i]] = resolved[i];
+    entry(misses[i].rgb()).store(static_cast<uint8_t>(resolved[i] + 1), std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Compare a color against the whole palette
+ * On equal distance the color with the lowest hex value is picked.
+ * @param color The color to compare
+ * @return The index of the closest color
+ */
+int PaletteLookup::findClosestIndex(const PackedColor color) const {
+  const Color pixel(color);
+  const HSL pixelHsl = hsl ? pixel.rgbToHsl() : HSL{};
+  int minDistance = 1000000;
+  int closest = 0;
+  for (int i = 0; i < colors.size(); i++) {
+    if (packed[i].rgb() == color.rgb()) {
+      return i;
+    }
+    int distance = 1000000;
+    if (hsl) distance = hslDistance(hslColors[i], pixelHsl);
+    else distance = colors[i].getDistance(pixel);
+    if (distance < minDistance) {
+      minDistance = distance;
+      closest = i;
+    }
+    if (distance == minDistance) {
+      if (packed[i].rgb() < packed[closest].rgb()) {
+        closest = i;
+      }
+    }
+  }
+  return closest;
+}
 
 /**
  * @brief Default constructor
@@ -56,6 +302,7 @@ const std::vector<Color>& ColorMap::getColors() const {
  */
 void ColorMap::addColor(const Color& color) {
   colors.emplace_back(color);
+  resetLookups();
 }
 /**
  * @brief Add a color to the list
@@ -76,6 +323,7 @@ void ColorMap::removeColor(const int index) {
     throw std::invalid_argument("Index out of bounds");
   }
   colors.erase(colors.begin() + index);
+  resetLookups();
 }
 
 /**
@@ -85,7 +333,7 @@ void ColorMap::removeColor(const int index) {
  */
 void ColorMap::removeColor(const Color &color) {
   for (int i = 0; i < colors.size(); i++) {
-    if (colors.at(i).getHex() == color.getHex()) {
+    if (colors.at(i).getPacked() == color.getPacked()) {
       removeColor(i);
       return;
     }
@@ -110,6 +358,71 @@ void ColorMap::removeColor(const std::string &color) {
  */
 void ColorMap::clear() {
   colors.clear();
+  resetLookups();
+}
+
+/**
+ * @brief Get the lookup table for the current palette
+ * @param hsl if the lookup should use hsl or rgb distance method
+ * @return The lookup table
+ */
+std::shared_ptr<const PaletteLookup> ColorMap::getLookup(bool hsl) const {
+  std::shared_ptr<const PaletteLookup> lookup = std::atomic_load(&lookups[hsl]);
+  if (!lookup) {
+    lookup = PaletteLookup::forPalette(colors, hsl);
+    std::atomic_store(&lookups[hsl], lookup);
+  }
+  return lookup;
+}
+
+/**
+ * @brief Drop the lookup tables after the palette has changed
+ */
+void ColorMap::resetLookups() {
+  std::atomic_store(&lookups[0], std::shared_ptr<const PaletteLookup>());
+  std::atomic_store(&lookups[1], std::shared_ptr<const PaletteLookup>());
+}
+
+/**
+ * @brief Get the index of the closest color to the given color
+ * @param color The color to compare, alpha is ignored
+ * @param hsl if the method should use hsl or rgb distance method
+ * @return The index of the closest color
+ * @throws out_of_range If the color map is empty
+ */
+int ColorMap::getClosestIndex(const PackedColor color, bool hsl) const {
+  if (colors.empty()) {
+    throw std::out_of_range("Color map is empty");
+  }
+  return getLookup(hsl)->getClosestIndex(color);
+}
+
+/**
+ * @brief Get the index of the closest color for a block of pixels
+ * @param pixels The colors to compare, alpha is ignored
+ * @param indices Output, the index of the closest color for every pixel
+ * @param count The number of pixels
+ * @param hsl if the method should use hsl or rgb distance method
+ * @throws out_of_range If the color map is empty
+ */
+void ColorMap::getClosestIndices(const PackedColor *pixels, int *indices, size_t count, bool hsl) const {
+  if (count == 0) {
+    return;
+  }
+  if (colors.empty()) {
+    throw std::out_of_range("Color map is empty");
+  }
+  getLookup(hsl)->getClosestIndices(pixels, indices, count);
+}
+
+/**
+ * @brief Get the index of the closest color to the given color
+ * @param color The color to compare
+ * @param hsl if the method should use hsl or rgb distance method
+ * @return The index of the closest color
+ */
+int ColorMap::getClosestIndex(const Color& color, bool hsl) const {
+  return getClosestIndex(color.getPacked(), hsl);
 }
 
 /**
@@ -119,26 +432,7 @@ void ColorMap::clear() {
  * @return The closest color
  */
 Color ColorMap::getClosestColor(const Color& color, bool hsl) const {
-  int minDistance = 1000000;
-  Color col = colors.at(0);
-  for (const auto &c : colors) {
-    if (c.getHex() == color.getHex()) {
-      return c;
-    }
-    int distance = 1000000;
-    if (hsl) distance = c.getHslDistance(color);
-    else distance = c.getDistance(color);
-    if (distance < minDistance) {
-      minDistance = distance;
-      col = c;
-    }
-    if (distance == minDistance) {
-      if (c.getHex() < col.getHex()) {
-        col = c;
-      }
-    }
-  }
-  return col;
+  return colors.at(getClosestIndex(color, hsl));
 }
 
 /**
@@ -0,0 +1,523 @@
+#include "../header/ContourMesh.hpp"
+#include <algorithm>
+#include <cmath>
+#include <opencv2/core.hpp>
+#include "../header/Islands.hpp"
+#include "../header/ThreadBudget.hpp"
+
+// the sides of a cell, the corners of a loop lie in their middle
+enum Side { Top, Right, Bottom, Left };
+
+// the middle of every side in the doubled grid, relative to the top left corner of the cell
+static constexpr int sideOffset[4][2] = {{1, 0}, {2, 1}, {1, 2}, {0, 1}};
+// the cell across every side
+static constexpr int sideStep[4][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+// the two pixels next to every side, relative to the top left corner of the cell
+static constexpr int sidePixels[4][2][2] = {{{0, 0}, {1, 0}}, {{1, 0}, {1, 1}}, {{0, 1}, {1, 1}}, {{0, 0}, {0, 1}}};
+
+/**
+ * @brief The contour segments of every cell index, as the side they come from and go to
+ * The index has the same bits as in MarchingSquare: top left, top right, bottom right,
+ * bottom left. The inside is on the right of every segment, and the saddles 0101 and 1010
+ * connect their two full corners, like the lookup tables of MarchingSquare do.
+ */
+static constexpr int segmentLookup[16][2][2] = {
+    {{-1, -1}, {-1, -1}},         // 0000
+    {{Top, Left}, {-1, -1}},      // 0001
+    {{Right, Top}, {-1, -1}},     // 0010
+    {{Right, Left}, {-1, -1}},    // 0011
+    {{Bottom, Right}, {-1, -1}},  // 0100
+    {{Top, Right}, {Bottom, Left}}, // 0101
+    {{Bottom, Top}, {-1, -1}},    // 0110
+    {{Bottom, Left}, {-1, -1}},   // 0111
+    {{Left, Bottom}, {-1, -1}},   // 1000
+    {{Top, Bottom}, {-1, -1}},    // 1001
+    {{Left, Top}, {Right, Bottom}}, // 1010
+    {{Right, Bottom}, {-1, -1}},  // 1011
+    {{Left, Right}, {-1, -1}},    // 1100
+    {{Top, Right}, {-1, -1}},     // 1101
+    {{Left, Top}, {-1, -1}},      // 1110
+    {{-1, -1}, {-1, -1}}          // 1111
+};
+
+/**
+ * @brief Twice the signed area of a loop, positive for an outer loop
+ */
+static int64_t loopArea(const std::vector<GridPoint> &points) {
+    int64_t sum = 0;
+    for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i++) {
+        sum += static_cast<int64_t>(points[j][0]) * points[i][1] - static_cast<int64_t>(points[i][0]) * points[j][1];
+    }
+    return sum;
+}
+
+/**
+ * @brief The constructor of the contour mesh
+ * Copies the label into an occupancy grid with an empty border of one pixel.
+ * @param labels the label grid to mesh, only read during construction
+ * @param label the label of the pixels that are inside the mesh
+ * @param tolerance how far in pixels a simplified outline may stray from the traced one,
+ * 0 only drops the corners along straight runs
+ */
+ContourMesh::ContourMesh(const LabelView &labels, uint8_t label, double tolerance)
+    : width(labels.width), height(labels.height), paddedWidth(labels.width + 2), paddedHeight(labels.height + 2),
+      tolerance(tolerance), occupancy(static_cast<size_t>(paddedWidth) * paddedHeight, 0) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = labels.row(y);
+        uint8_t *occupied = occupancy.data() + static_cast<size_t>(y + 1) * paddedWidth + 1;
+        for (int x = 0; x < width; x++) {
+            occupied[x] = row[x] == label;
+        }
+    }
+    size = (sqrt(width*height))/5;
+}
+
+/**
+ * @brief gets the lookup index of a cell of the padded grid
+ * @param x the x value of the top left corner
+ * @param y the y value of the top left corner
+ */
+int ContourMesh::cellIndex(int x, int y) const {
+    const uint8_t *top = occupancy.data() + static_cast<size_t>(y) * paddedWidth + x;
+    const uint8_t *bottom = top + paddedWidth;
+    return top[0] | (top[1] << 1) | (bottom[1] << 2) | (bottom[0] << 3);
+}
+
+/**
+ * @brief gets the visited flag of the middle of a cell side
+ * Every side is shared by two cells, so the flags are kept per horizontal and vertical
+ * edge of the grid, horizontal edges first.
+ */
+uint8_t &ContourMesh::visitedEdge(std::vector<uint8_t> &visited, int cellX, int cellY, int side) const {
+    const size_t horizontal = static_cast<size_t>(paddedWidth - 1) * paddedHeight;
+    switch (side) {
+        case Top: return visited[static_cast<size_t>(cellY) * (paddedWidth - 1) + cellX];
+        case Bottom: return visited[static_cast<size_t>(cellY + 1) * (paddedWidth - 1) + cellX];
+        case Left: return visited[horizontal + static_cast<size_t>(cellY) * paddedWidth + cellX];
+        default: return visited[horizontal + static_cast<size_t>(cellY) * paddedWidth + cellX + 1];
+    }
+}
+
+/**
+ * @brief follows the contour from a segment until it is back at the start
+ * Every segment ends on the side of the next cell it continues in, and the empty
+ * border keeps the contour away from the edge of the grid.
+ * @param cellX the x value of the top left corner of the first cell
+ * @param cellY the y value of the top left corner of the first cell
+ * @param side the side the first segment comes from
+ * @param visited the visited flags of the edges, updated for the whole loop
+ * @param loop output, the corners of the loop
+ */
+void ContourMesh::traceLoop(int cellX, int cellY, int side, std::vector<uint8_t> &visited, Loop &loop) const {
+    int x = cellX, y = cellY, from = side;
+    do {
+        visitedEdge(visited, x, y, from) = 1;
+        loop.points.push_back({x * 2 + sideOffset[from][0], y * 2 + sideOffset[from][1]});
+        const auto &segments = segmentLookup[cellIndex(x, y)];
+        const int to = segments[0][0] == from ? segments[0][1] : segments[1][1];
+        x += sideStep[to][0];
+        y += sideStep[to][1];
+        from = (to + 2) % 4;
+    } while (x != cellX || y != cellY || from != side);
+}
+
+/**
+ * @brief The cross product of b - a and c - a
+ */
+static int64_t cross(const GridPoint &a, const GridPoint &b, const GridPoint &c) {
+    return (static_cast<int64_t>(b[0]) - a[0]) * (static_cast<int64_t>(c[1]) - a[1]) -
+           (static_cast<int64_t>(b[1]) - a[1]) * (static_cast<int64_t>(c[0]) - a[0]);
+}
+
+/**
+ * @brief The squared distance of a point to a segment
+ */
+static double segmentDistance2(const GridPoint &p, const GridPoint &a, const GridPoint &b) {
+    const int64_t abx = b[0] - a[0], aby = b[1] - a[1];
+    const int64_t apx = p[0] - a[0], apy = p[1] - a[1];
+    const int64_t length2 = abx * abx + aby * aby;
+    const int64_t along = apx * abx + apy * aby;
+    if (length2 == 0 || along <= 0) return static_cast<double>(apx * apx + apy * apy);
+    if (along >= length2) {
+        const int64_t bpx = p[0] - b[0], bpy = p[1] - b[1];
+        return static_cast<double>(bpx * bpx + bpy * bpy);
+    }
+    const double c = static_cast<double>(abx * apy - aby * apx);
+    return c * c / static_cast<double>(length2);
+}
+
+/**
+ * @brief The corner between first and last, going around the loop, that is farthest
+ * from the line between them
+ * @return the index of the corner, or the size of the loop if all of them are on the line
+ */
+static size_t farthestCorner(const std::vector<GridPoint> &points, size_t first, size_t last) {
+    const size_t n = points.size();
+    size_t far = n;
+    double farthest = 0;
+    for (size_t i = (first + 1) % n; i != last; i = (i + 1) % n) {
+        const double d = segmentDistance2(points[i], points[first], points[last]);
+        if (d > farthest) {
+            farthest = d;
+            far = i;
+        }
+    }
+    return far;
+}
+
+/**
+ * @brief Whether two segments cross or touch
+ */
+static bool segmentsMeet(const GridPoint &a, const GridPoint &b, const GridPoint &c, const GridPoint &d) {
+    const auto sign = [](int64_t v) { return (v > 0) - (v < 0); };
+    const auto within = [](const GridPoint &p, const GridPoint &q, const GridPoint &r) {
+        return std::min(p[0], r[0]) <= q[0] && q[0] <= std::max(p[0], r[0]) &&
+               std::min(p[1], r[1]) <= q[1] && q[1] <= std::max(p[1], r[1]);
+    };
+    const int o1 = sign(cross(a, b, c)), o2 = sign(cross(a, b, d));
+    const int o3 = sign(cross(c, d, a)), o4 = sign(cross(c, d, b));
+    if (o1 != o2 && o3 != o4) return true;
+    return (o1 == 0 && within(a, c, b)) || (o2 == 0 && within(a, d, b)) ||
+           (o3 == 0 && within(c, a, d)) || (o4 == 0 && within(c, b, d));
+}
+
+/**
+ * @brief Marks the corners Douglas-Peucker keeps of a closed loop
+ * The loop is split at its first corner and the corner farthest from it, and each half
+ * keeps the corners that are farther than the limit from the line between its kept
+ * neighbors. A loop that would lose its area or turn around keeps every corner.
+ * @param points the corners of the loop
+ * @param limit the squared tolerance in the doubled grid
+ * @param keep output, whether every corner is kept
+ */
+static void douglasPeucker(const std::vector<GridPoint> &points, double limit, std::vector<uint8_t> &keep) {
+    const size_t n = points.size();
+    keep.assign(n, 0);
+    size_t far = 0;
+    double farthest = -1;
+    for (size_t i = 1; i < n; i++) {
+        const double d = segmentDistance2(points[i], points[0], points[0]);
+        if (d > farthest) {
+            farthest = d;
+            far = i;
+        }
+    }
+    keep[0] = 1;
+    keep[far] = 1;
+    std::vector<std::pair<size_t, size_t>> stack = {{0, far}, {far, n}};
+    while (!stack.empty()) {
+        const auto [first, last] = stack.back();
+        stack.pop_back();
+        size_t split = 0;
+        double worst = limit;
+        for (size_t i = first + 1; i < last; i++) {
+            const double d = segmentDistance2(points[i], points[first], points[last % n]);
+            if (d > worst) {
+                worst = d;
+                split = i;
+            }
+        }
+        if (split != 0) {
+            keep[split] = 1;
+            stack.emplace_back(first, split);
+            stack.emplace_back(split, last);
+        }
+    }
+
+    std::vector<GridPoint> kept;
+    for (size_t i = 0; i < n; i++) {
+        if (keep[i]) kept.push_back(points[i]);
+    }
+    const int64_t before = loopArea(points);
+    const int64_t after = kept.size() >= 3 ? loopArea(kept) : 0;
+    if (after == 0 || (after > 0) != (before > 0)) {
+        std::fill(keep.begin(), keep.end(), 1);
+    }
+}
+
+/**
+ * @brief Drops the corners in the middle of straight runs of a loop
+ */
+static void dropStraightCorners(std::vector<GridPoint> &points) {
+    bool dropped = true;
+    while (dropped && points.size() > 3) {
+        dropped = false;
+        std::vector<GridPoint> kept;
+        kept.reserve(points.size());
+        const size_t n = points.size();
+        for (size_t i = 0; i < n; i++) {
+            const GridPoint &a = kept.empty() ? points[n - 1] : kept.back();
+            const GridPoint &b = points[i];
+            const GridPoint &c = points[(i + 1) % n];
+            const int64_t along = (static_cast<int64_t>(b[0]) - a[0]) * (c[0] - b[0]) + (static_cast<int64_t>(b[1]) - a[1]) * (c[1] - b[1]);
+            if (cross(a, b, c) == 0 && along > 0 && n - i + kept.size() > 3) {
+                dropped = true;
+                continue;
+            }
+            kept.push_back(b);
+        }
+        points = std::move(kept);
+    }
+}
+
+/**
+ * @brief simplifies the loops of one region without changing how they lie to each other
+ * Every loop is simplified with Douglas-Peucker on its own. Segments that then cross or
+ * touch another segment of the region get back their farthest dropped corner, until no
+ * segments meet. If a loop still ends up on the wrong side of another one, because a
+ * whole small loop was passed by, the region keeps its traced outlines.
+ * @param loops the loops of the region, the outer one first
+ */
+void ContourMesh::simplify(std::vector<Loop> &loops) const {
+    if (tolerance > 0) {
+        // a pixel is two units of the doubled grid
+        const double limit = 4 * tolerance * tolerance;
+        std::vector<std::vector<uint8_t>> keep(loops.size());
+        for (size_t l = 0; l < loops.size(); l++) {
+            if (loops[l].points.size() < 4) {
+                keep[l].assign(loops[l].points.size(), 1);
+            } else {
+                douglasPeucker(loops[l].points, limit, keep[l]);
+            }
+        }
+
+        int32_t minX = INT32_MAX, minY = INT32_MAX, maxX = INT32_MIN, maxY = INT32_MIN;
+        for (const GridPoint &p : loops.front().points) {
+            minX = std::min(minX, p[0]);
+            minY = std::min(minY, p[1]);
+            maxX = std::max(maxX, p[0]);
+            maxY = std::max(maxY, p[1]);
+        }
+        // the segments are bucketed in square cells of the doubled grid
+        constexpr int32_t cellSize = 16;
+        const int32_t cellsX = (maxX - minX) / cellSize + 1;
+        const int32_t cellsY = (maxY - minY) / cellSize + 1;
+
+        struct Segment {
+            uint32_t loop;
+            uint32_t first;
+            uint32_t last;
+        };
+        std::vector<Segment> segments;
+        std::vector<uint32_t> offsets, members;
+        const auto collect = [&]() {
+            segments.clear();
+            for (uint32_t l = 0; l < loops.size(); l++) {
+                const size_t n = loops[l].points.size();
+                uint32_t first = 0;
+                for (uint32_t i = 1; i <= n; i++) {
+                    if (i < n && !keep[l][i]) continue;
+                    segments.push_back({l, first, static_cast<uint32_t>(i % n)});
+                    first = i;
+                }
+            }
+            const auto cells = [&](const Segment &s, auto &&visit) {
+                const GridPoint &a = loops[s.loop].points[s.first];
+                const GridPoint &b = loops[s.loop].points[s.last];
+                const int32_t x0 = (std::min(a[0], b[0]) - minX) / cellSize, x1 = (std::max(a[0], b[0]) - minX) / cellSize;
+                const int32_t y0 = (std::min(a[1], b[1]) - minY) / cellSize, y1 = (std::max(a[1], b[1]) - minY) / cellSize;
+                for (int32_t y = y0; y <= y1; y++) {
+                    for (int32_t x = x0; x <= x1; x++) visit(static_cast<size_t>(y) * cellsX + x);
+                }
+            };
+            offsets.assign(static_cast<size_t>(cellsX) * cellsY + 1, 0);
+            for (const Segment &s : segments) cells(s, [&](size_t cell) { offsets[cell + 1]++; });
+            for (size_t c = 1; c < offsets.size(); c++) offsets[c] += offsets[c - 1];
+            members.resize(offsets.back());
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (uint32_t i = 0; i < segments.size(); i++) cells(segments[i], [&](size_t cell) { members[fill[cell]++] = i; });
+        };
+
+        const auto point = [&](uint32_t loop, uint32_t index) -> const GridPoint & { return loops[loop].points[index]; };
+        const auto conflict = [&](const Segment &s, const Segment &t) {
+            if (s.loop == t.loop && (s.last == t.first || t.last == s.first)) {
+                // neighbors only meet at their shared corner, unless one folds back onto the other
+                const Segment &before = s.last == t.first ? s : t;
+                const Segment &after = s.last == t.first ? t : s;
+                const GridPoint &a = point(before.loop, before.first);
+                const GridPoint &b = point(before.loop, before.last);
+                const GridPoint &c = point(after.loop, after.last);
+                const int64_t along = (static_cast<int64_t>(b[0]) - a[0]) * (c[0] - b[0]) + (static_cast<int64_t>(b[1]) - a[1]) * (c[1] - b[1]);
+                return cross(a, b, c) == 0 && along < 0;
+            }
+            return segmentsMeet(point(s.loop, s.first), point(s.loop, s.last), point(t.loop, t.first), point(t.loop, t.last));
+        };
+
+        bool refined = true;
+        while (refined) {
+            refined = false;
+            collect();
+            std::vector<uint8_t> meets(segments.size(), 0);
+            for (size_t c = 0; c + 1 < offsets.size(); c++) {
+                for (uint32_t i = offsets[c]; i < offsets[c + 1]; i++) {
+                    for (uint32_t j = i + 1; j < offsets[c + 1]; j++) {
+                        const uint32_t s = members[i], t = members[j];
+                        if ((meets[s] && meets[t]) || !conflict(segments[s], segments[t])) continue;
+                        meets[s] = meets[t] = 1;
+                    }
+                }
+            }
+            for (uint32_t s = 0; s < segments.size(); s++) {
+                if (!meets[s]) continue;
+                const Segment &segment = segments[s];
+                const size_t far = farthestCorner(loops[segment.loop].points, segment.first, segment.last);
+                if (far < loops[segment.loop].points.size()) {
+                    keep[segment.loop][far] = 1;
+                    refined = true;
+                }
+            }
+        }
+
+        // the first corner of a loop is always kept, and has to stay inside the outer loop
+        // and outside of the holes, which a ray to the right tells by its crossings
+        std::vector<uint32_t> tested(segments.size(), UINT32_MAX);
+        bool nested = true;
+        for (uint32_t l = 0; l < loops.size() && nested; l++) {
+            const GridPoint &p = loops[l].points[0];
+            const int32_t row = (p[1] - minY) / cellSize;
+            const int32_t column = (p[0] - minX) / cellSize;
+            if (row < 0 || row >= cellsY || column < 0 || column >= cellsX) {
+                nested = l == 0;
+                continue;
+            }
+            bool inside = false;
+            for (int32_t x = column; x < cellsX; x++) {
+                const size_t cell = static_cast<size_t>(row) * cellsX + x;
+                for (uint32_t i = offsets[cell]; i < offsets[cell + 1]; i++) {
+                    const uint32_t s = members[i];
+                    if (tested[s] == l || segments[s].loop == l) continue;
+                    tested[s] = l;
+                    const GridPoint &a = point(segments[s].loop, segments[s].first);
+                    const GridPoint &b = point(segments[s].loop, segments[s].last);
+                    if ((a[1] > p[1]) == (b[1] > p[1])) continue;
+                    if ((b[1] > a[1]) == (cross(a, b, p) > 0)) inside = !inside;
+                }
+            }
+            nested = inside == (l != 0);
+        }
+
+        for (size_t l = 0; l < loops.size(); l++) {
+            if (!nested) break;
+            std::vector<GridPoint> kept;
+            for (size_t i = 0; i < loops[l].points.size(); i++) {
+                if (keep[l][i]) kept.push_back(loops[l].points[i]);
+            }
+            loops[l].points = std::move(kept);
+        }
+    }
+    for (Loop &loop : loops) {
+        dropStraightCorners(loop.points);
+    }
+}
+
+/**
+ * @brief traces, simplifies and triangulates the outlines of all regions
+ * The loops are traced in scan order and grouped by the 8-connected region they bound.
+ * The regions are then simplified and triangulated in parallel, each on its own, and
+ * added to the mesh in the order their outer loop was found, so the mesh is the same
+ * no matter how many threads are used.
+ */
+void ContourMesh::traceContours() {
+    const Components components = findComponents(LabelView(occupancy.data(), paddedWidth, paddedHeight, paddedWidth), true);
+    const size_t edges = static_cast<size_t>(paddedWidth - 1) * paddedHeight + static_cast<size_t>(paddedWidth) * (paddedHeight - 1);
+    std::vector<uint8_t> visited(edges, 0);
+
+    std::vector<std::vector<Loop>> regions;
+    std::vector<int32_t> regionOf(components.count(), -1);
+    for (int y = 0; y + 1 < paddedHeight; y++) {
+        for (int x = 0; x + 1 < paddedWidth; x++) {
+            const int index = cellIndex(x, y);
+            if (index == 0 || index == 15) continue;
+            for (const auto &segment : segmentLookup[index]) {
+                if (segment[0] < 0 || visitedEdge(visited, x, y, segment[0])) continue;
+                Loop loop;
+                traceLoop(x, y, segment[0], visited, loop);
+                loop.area2 = loopArea(loop.points);
+                // one of the pixels next to the first corner is inside, and belongs to the region
+                const auto &pixels = sidePixels[segment[0]];
+                const int inside = occupancy[static_cast<size_t>(y + pixels[0][1]) * paddedWidth + x + pixels[0][0]] ? 0 : 1;
+                const uint32_t component = components.at(x + pixels[inside][0], y + pixels[inside][1]);
+
+                int32_t &region = regionOf[component];
+                if (region == -1) {
+                    region = static_cast<int32_t>(regions.size());
+                    regions.emplace_back();
+                }
+                std::vector<Loop> &loops = regions[region];
+                loops.push_back(std::move(loop));
+                // the outer loop goes first
+                if (loops.back().area2 > 0 && loops.size() > 1) {
+                    std::swap(loops.front(), loops.back());
+                }
+            }
+        }
+    }
+
+    std::vector<std::vector<GridPoint>> corners(regions.size());
+    std::vector<std::vector<uint32_t>> ringStarts(regions.size());
+    std::vector<std::vector<std::array<uint32_t, 3>>> triangles(regions.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(regions.size())), [&](const cv::Range &range) {
+        for (int r = range.start; r < range.end; r++) {
+            simplify(regions[r]);
+            for (Loop &loop : regions[r]) {
+                ringStarts[r].push_back(static_cast<uint32_t>(corners[r].size()));
+                corners[r].insert(corners[r].end(), loop.points.begin(), loop.points.end());
+                std::vector<GridPoint>().swap(loop.points);
+            }
+            triangulatePolygon(corners[r], ringStarts[r], triangles[r]);
+        }
+    }, parallelStripes());
+
+    std::vector<Face> faces;
+    for (size_t r = 0; r < regions.size(); r++) {
+        const int base = static_cast<int>(mesh.getVertices().size());
+        for (const GridPoint &point : corners[r]) {
+            // the doubled grid of the padded pixels starts one pixel before the one of MarchingSquare
+            const float x = static_cast<float>(point[0] - 2 - width + 1);
+            const float y = static_cast<float>(point[1] - 2 - height + 1);
+            mesh.addVertex(x, y, -size/2);
+            mesh.addVertex(x, y, size/2);
+        }
+        faces.clear();
+        for (const auto &[a, b, c] : triangles[r]) {
+            faces.emplace_back(base + 2 * a + 1, base + 2 * b + 1, base + 2 * c + 1);
+            faces.emplace_back(base + 2 * a, base + 2 * c, base + 2 * b);
+        }
+        for (size_t ring = 0; ring < ringStarts[r].size(); ring++) {
+            const uint32_t first = ringStarts[r][ring];
+            const uint32_t end = ring + 1 < ringStarts[r].size() ? ringStarts[r][ring + 1] : static_cast<uint32_t>(corners[r].size());
+            for (uint32_t k = first; k < end; k++) {
+                const int a = base + 2 * k;
+                const int b = base + 2 * (k + 1 < end ? k + 1 : first);
+                faces.emplace_back(b, a + 1, a);
+                faces.emplace_back(a + 1, b, b + 1);
+            }
+        }
+        mesh.addFaces(faces);
+    }
+}
+
+/**
+ * @brief reduces the triangles of the traced mesh
+ * @param options the triangle budget and error tolerance
+ * @return the number of triangles that were removed
+ */
+size_t ContourMesh::decimate(const DecimateOptions &options) {
+    return decimateMesh(mesh, options);
+}
+
+/**
+ * @brief gets the mesh as a string
+ * @return the mesh as ascii stl
+ */
+std::string ContourMesh::getMeshString() {
+    return mesh.toString();
+}
+
+/**
+ * @brief gets the mesh as binary stl
+ * @return the bytes of the binary stl
+ */
+std::string ContourMesh::getMeshBinary() const {
+    return mesh.toBinarySTL();
+}
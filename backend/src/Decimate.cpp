@@ -0,0 +1,460 @@
+#include "../header/Decimate.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <utility>
+#include <vector>
+
+// weight of the planes along open boundaries and sharp edges, against 1 for a face plane
+static constexpr double featureWeight = 1000.0;
+// edges whose faces meet at more than 60 degrees are sharp
+static constexpr double sharpCos = 0.5;
+// a collapse may turn a face by at most 60 degrees
+static constexpr double flipCos = 0.5;
+// squared distance that still counts as no error, for the rounding of the quadrics
+static constexpr double errorSlack = 1e-12;
+// the sine of the smallest angle a face may have after a collapse, about 0.003 degrees;
+// thinner faces are slivers that readers of the model may see with no area or flipped
+static constexpr double minSine = 5e-5;
+
+using Point = std::array<double, 3>;
+
+static Point sub(const Point &a, const Point &b) { return {a[0] - b[0], a[1] - b[1], a[2] - b[2]}; }
+static double dot(const Point &a, const Point &b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+static Point cross(const Point &a, const Point &b) {
+    return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+}
+
+/**
+ * @brief Rounds a point to the float precision the mesh stores it in
+ */
+static Point toFloat(const Point &p) {
+    return {static_cast<float>(p[0]), static_cast<float>(p[1]), static_cast<float>(p[2])};
+}
+
+/**
+ * @brief Checks that every angle of a triangle is far enough from 0 and 180 degrees
+ * The sine of the angle at a corner is the length of the normal over the product of
+ * the two edges at that corner, so this is relative to the size of the triangle.
+ */
+static bool isWellShaped(const Point &a, const Point &b, const Point &c, const Point &normal) {
+    const double area = std::sqrt(dot(normal, normal));
+    const Point ab = sub(b, a), bc = sub(c, b), ca = sub(a, c);
+    const double lab = std::sqrt(dot(ab, ab)), lbc = std::sqrt(dot(bc, bc)), lca = std::sqrt(dot(ca, ca));
+    return area > minSine * lab * lca && area > minSine * lab * lbc && area > minSine * lbc * lca;
+}
+
+/**
+ * @brief The sum of the squared distances to a set of planes, as a symmetric 4x4 matrix
+ * Only the upper triangle is stored: aa ab ac ad bb bc bd cc cd dd. weight is the sum
+ * of the plane weights, to turn the error into a mean distance.
+ */
+struct Quadric {
+    std::array<double, 10> q{};
+    double weight = 0;
+
+    void addPlane(const Point &n, double d, double w) {
+        q[0] += w * n[0] * n[0]; q[1] += w * n[0] * n[1]; q[2] += w * n[0] * n[2]; q[3] += w * n[0] * d;
+        q[4] += w * n[1] * n[1]; q[5] += w * n[1] * n[2]; q[6] += w * n[1] * d;
+        q[7] += w * n[2] * n[2]; q[8] += w * n[2] * d;
+        q[9] += w * d * d;
+        weight += w;
+    }
+
+    Quadric &operator+=(const Quadric &other) {
+        for (size_t i = 0; i < q.size(); i++) q[i] += other.q[i];
+        weight += other.weight;
+        return *this;
+    }
+
+    double error(const Point &p) const {
+        const double x = p[0], y = p[1], z = p[2];
+        const double e = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                       + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                       + q[7] * z * z + 2 * q[8] * z + q[9];
+        return std::max(0.0, e);
+    }
+
+    /**
+     * @brief Find the point with the smallest error
+     * @return false if the matrix is singular, like for a flat area or a straight edge
+     */
+    bool optimum(Point &p) const {
+        const double a = q[0], b = q[1], c = q[2], e = q[4], f = q[5], i = q[7];
+        const double det = a * (e * i - f * f) - b * (b * i - f * c) + c * (b * f - e * c);
+        const double scale = std::max({std::fabs(a), std::fabs(e), std::fabs(i)});
+        if (std::fabs(det) <= 1e-9 * scale * scale * scale) {
+            return false;
+        }
+        const double r0 = -q[3], r1 = -q[6], r2 = -q[8];
+        p[0] = (r0 * (e * i - f * f) - b * (r1 * i - f * r2) + c * (r1 * f - e * r2)) / det;
+        p[1] = (a * (r1 * i - f * r2) - r0 * (b * i - f * c) + c * (b * r2 - r1 * c)) / det;
+        p[2] = (a * (e * r2 - r1 * f) - b * (b * r2 - r1 * c) + r0 * (b * f - e * c)) / det;
+        return true;
+    }
+};
+
+/**
+ * @brief An edge in the heap, stale once the version of one of its vertices changed
+ * Edges with the same error, like all edges of a flat area, go shortest first, so
+ * the area is thinned out evenly and does not collapse into a fan around one vertex.
+ */
+struct Candidate {
+    double error;
+    double length;
+    uint32_t u, v;
+    uint32_t versionU, versionV;
+
+    bool operator>(const Candidate &other) const {
+        return error != other.error ? error > other.error : length > other.length;
+    }
+};
+
+/**
+ * @brief The working state of one decimation
+ */
+class Decimator {
+  public:
+    explicit Decimator(const Mesh &mesh);
+    size_t run(const DecimateOptions &options);
+    void write(Mesh &mesh) const;
+
+  private:
+    std::vector<Point> points;
+    std::vector<std::array<uint32_t, 3>> faces;
+    std::vector<uint8_t> faceAlive;
+    std::vector<std::vector<uint32_t>> vertexFaces;
+    std::vector<Quadric> quadrics;
+    std::vector<uint32_t> versions;
+    std::vector<uint8_t> vertexAlive;
+    std::vector<uint8_t> boundary;
+    std::vector<uint32_t> marks;
+    uint32_t stamp = 0;
+    size_t liveFaces = 0;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> heap;
+
+    Point normal(const std::array<uint32_t, 3> &face) const;
+    void addFeaturePlane(uint32_t a, uint32_t b, const Point &faceNormal);
+    void findFeatures();
+    Point target(uint32_t u, uint32_t v, double &error) const;
+    void push(uint32_t u, uint32_t v);
+    void pushNeighbors(uint32_t v);
+    bool canCollapse(uint32_t u, uint32_t v, const Point &p);
+    void collapse(uint32_t u, uint32_t v, const Point &p);
+};
+
+Point Decimator::normal(const std::array<uint32_t, 3> &face) const {
+    return cross(sub(points[face[1]], points[face[0]]), sub(points[face[2]], points[face[0]]));
+}
+
+/**
+ * @brief Builds the adjacency and the quadrics of a mesh
+ * The face lists of the vertices are counted first and filled after, so building
+ * them is linear in the size of the mesh.
+ */
+Decimator::Decimator(const Mesh &mesh) {
+    const auto &vertices = mesh.getVertices();
+    points.reserve(vertices.size());
+    for (const Vertex &vertex : vertices) {
+        points.push_back({vertex.x, vertex.y, vertex.z});
+    }
+    std::vector<uint32_t> valence(vertices.size(), 0);
+    for (const Face &face : mesh.getFaces()) {
+        // faces that repeat a vertex have no area and no edges worth keeping
+        if (face.v1 == face.v2 || face.v2 == face.v3 || face.v1 == face.v3) continue;
+        faces.push_back({static_cast<uint32_t>(face.v1), static_cast<uint32_t>(face.v2), static_cast<uint32_t>(face.v3)});
+        valence[face.v1]++;
+        valence[face.v2]++;
+        valence[face.v3]++;
+    }
+    faceAlive.assign(faces.size(), 1);
+    liveFaces = faces.size();
+    vertexFaces.resize(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        vertexFaces[i].reserve(valence[i]);
+    }
+    quadrics.resize(points.size());
+    for (uint32_t f = 0; f < faces.size(); f++) {
+        const Point n = normal(faces[f]);
+        const double length = std::sqrt(dot(n, n));
+        const Point unit = length > 0 ? Point{n[0] / length, n[1] / length, n[2] / length} : Point{0, 0, 0};
+        const double d = -dot(unit, points[faces[f][0]]);
+        for (uint32_t v : faces[f]) {
+            vertexFaces[v].push_back(f);
+            if (length > 0) quadrics[v].addPlane(unit, d, 1.0);
+        }
+    }
+    versions.assign(points.size(), 0);
+    vertexAlive.assign(points.size(), 1);
+    boundary.assign(points.size(), 0);
+    marks.assign(points.size(), 0);
+    findFeatures();
+}
+
+/**
+ * @brief Adds the plane through an edge that stands upright on one of its faces to both ends
+ */
+void Decimator::addFeaturePlane(uint32_t a, uint32_t b, const Point &faceNormal) {
+    const Point m = cross(sub(points[b], points[a]), faceNormal);
+    const double length = std::sqrt(dot(m, m));
+    if (length == 0) return;
+    const Point unit = {m[0] / length, m[1] / length, m[2] / length};
+    const double d = -dot(unit, points[a]);
+    quadrics[a].addPlane(unit, d, featureWeight);
+    quadrics[b].addPlane(unit, d, featureWeight);
+}
+
+/**
+ * @brief Finds the open boundaries and sharp edges and queues every edge once
+ * Each vertex sorts the other corners of its faces, so an edge shows up once per face
+ * it belongs to. Edges with one face are open, edges with more than two are treated
+ * as open too, so collapses never make them worse.
+ */
+void Decimator::findFeatures() {
+    std::vector<std::pair<uint32_t, uint32_t>> around;
+    for (uint32_t a = 0; a < points.size(); a++) {
+        around.clear();
+        for (uint32_t f : vertexFaces[a]) {
+            for (uint32_t v : faces[f]) {
+                if (v != a) around.emplace_back(v, f);
+            }
+        }
+        std::sort(around.begin(), around.end());
+        for (size_t i = 0; i < around.size();) {
+            size_t j = i;
+            while (j < around.size() && around[j].first == around[i].first) j++;
+            const uint32_t b = around[i].first;
+            if (j - i != 2) {
+                boundary[a] = 1;
+            }
+            if (b > a) {
+                if (j - i != 2) {
+                    for (size_t k = i; k < j; k++) addFeaturePlane(a, b, normal(faces[around[k].second]));
+                } else {
+                    Point n0 = normal(faces[around[i].second]);
+                    Point n1 = normal(faces[around[i + 1].second]);
+                    const double lengths = std::sqrt(dot(n0, n0) * dot(n1, n1));
+                    if (lengths > 0 && dot(n0, n1) < sharpCos * lengths) {
+                        addFeaturePlane(a, b, n0);
+                        addFeaturePlane(a, b, n1);
+                    }
+                }
+                push(a, b);
+            }
+            i = j;
+        }
+    }
+}
+
+/**
+ * @brief Picks where the vertex of a collapsed edge goes
+ * The optimum of the quadric if there is one, otherwise the end or middle with the smaller error.
+ * The point is rounded to float, so the checks of a collapse see the positions that are written.
+ * @param error output, the mean squared distance of the picked point to the planes, 0 if it is within rounding
+ */
+Point Decimator::target(uint32_t u, uint32_t v, double &error) const {
+    Quadric q = quadrics[u];
+    q += quadrics[v];
+    const Point &a = points[u];
+    const Point &b = points[v];
+    Point best = b;
+    double cost = q.error(b);
+    const Point middle = toFloat({(a[0] + b[0]) / 2, (a[1] + b[1]) / 2, (a[2] + b[2]) / 2});
+    Point optimum;
+    const bool solved = q.optimum(optimum);
+    optimum = toFloat(optimum);
+    for (const Point &p : {a, middle}) {
+        const double e = q.error(p);
+        if (e < cost) {
+            cost = e;
+            best = p;
+        }
+    }
+    if (solved) {
+        const double e = q.error(optimum);
+        if (e < cost) {
+            cost = e;
+            best = optimum;
+        }
+    }
+    error = q.weight > 0 ? cost / q.weight : 0;
+    if (error <= errorSlack) error = 0;
+    return best;
+}
+
+void Decimator::push(uint32_t u, uint32_t v) {
+    double error;
+    target(u, v, error);
+    const Point edge = sub(points[u], points[v]);
+    heap.push({error, dot(edge, edge), u, v, versions[u], versions[v]});
+}
+
+/**
+ * @brief Queues the edges from a vertex to all its neighbors
+ */
+void Decimator::pushNeighbors(uint32_t v) {
+    stamp++;
+    marks[v] = stamp;
+    for (uint32_t f : vertexFaces[v]) {
+        for (uint32_t w : faces[f]) {
+            if (marks[w] != stamp) {
+                marks[w] = stamp;
+                push(v, w);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Checks that collapsing an edge keeps the mesh manifold and does not fold it
+ * The link condition: the only vertices next to both ends are the tips of the faces
+ * on the edge. An edge between two boundary vertices must be a boundary edge itself.
+ * The faces that stay must not turn by much and must not become slivers.
+ */
+bool Decimator::canCollapse(uint32_t u, uint32_t v, const Point &p) {
+    size_t shared = 0;
+    stamp += 2;
+    const uint32_t seenByU = stamp - 1;
+    for (uint32_t f : vertexFaces[u]) {
+        for (uint32_t w : faces[f]) marks[w] = seenByU;
+    }
+    for (uint32_t f : vertexFaces[v]) {
+        const auto &face = faces[f];
+        if (face[0] == u || face[1] == u || face[2] == u) shared++;
+    }
+    size_t common = 0;
+    for (uint32_t f : vertexFaces[v]) {
+        for (uint32_t w : faces[f]) {
+            if (w != u && w != v && marks[w] == seenByU) {
+                marks[w] = stamp;
+                common++;
+            }
+        }
+    }
+    if (shared == 0 || common != shared || (boundary[u] && boundary[v] && shared != 1)) {
+        return false;
+    }
+
+    for (uint32_t end : {u, v}) {
+        for (uint32_t f : vertexFaces[end]) {
+            std::array<uint32_t, 3> face = faces[f];
+            if ((face[0] == u || face[1] == u || face[2] == u) && (face[0] == v || face[1] == v || face[2] == v)) continue;
+            const Point before = normal(face);
+            const Point saved = points[end];
+            points[end] = p;
+            const Point after = normal(face);
+            points[end] = saved;
+            const double lengths = std::sqrt(dot(before, before) * dot(after, after));
+            if (lengths == 0 || dot(before, after) < flipCos * lengths) {
+                return false;
+            }
+            const Point &a = face[0] == end ? p : points[face[0]];
+            const Point &b = face[1] == end ? p : points[face[1]];
+            const Point &c = face[2] == end ? p : points[face[2]];
+            if (!isWellShaped(a, b, c, after)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Moves v to p and replaces u by v
+ */
+void Decimator::collapse(uint32_t u, uint32_t v, const Point &p) {
+    for (uint32_t f : vertexFaces[u]) {
+        auto &face = faces[f];
+        if (face[0] == v || face[1] == v || face[2] == v) {
+            faceAlive[f] = 0;
+            liveFaces--;
+        } else {
+            for (uint32_t &w : face) {
+                if (w == u) w = v;
+            }
+        }
+    }
+    std::vector<uint32_t> &merged = vertexFaces[v];
+    merged.insert(merged.end(), vertexFaces[u].begin(), vertexFaces[u].end());
+    merged.erase(std::remove_if(merged.begin(), merged.end(), [&](uint32_t f) { return !faceAlive[f]; }), merged.end());
+    std::vector<uint32_t>().swap(vertexFaces[u]);
+
+    points[v] = p;
+    quadrics[v] += quadrics[u];
+    boundary[v] |= boundary[u];
+    vertexAlive[u] = 0;
+    versions[v]++;
+}
+
+/**
+ * @brief Collapses edges until a limit is reached
+ * @return The number of triangles that were removed
+ */
+size_t Decimator::run(const DecimateOptions &options) {
+    const size_t start = liveFaces;
+    const double maxSquared = options.maxError * options.maxError;
+    while (!heap.empty() && (options.maxTriangles == 0 || liveFaces > options.maxTriangles)) {
+        const Candidate candidate = heap.top();
+        heap.pop();
+        const uint32_t u = candidate.u;
+        const uint32_t v = candidate.v;
+        if (!vertexAlive[u] || !vertexAlive[v] || versions[u] != candidate.versionU || versions[v] != candidate.versionV) {
+            continue;
+        }
+        // dead faces stay in the lists of the neighbors of a collapse until those collapse themselves
+        for (uint32_t end : {u, v}) {
+            auto &list = vertexFaces[end];
+            list.erase(std::remove_if(list.begin(), list.end(), [&](uint32_t f) { return !faceAlive[f]; }), list.end());
+        }
+        double error;
+        const Point p = target(u, v, error);
+        if (error > maxSquared) {
+            continue;
+        }
+        if (!canCollapse(u, v, p)) {
+            continue;
+        }
+        collapse(u, v, p);
+        pushNeighbors(v);
+    }
+    return start - liveFaces;
+}
+
+/**
+ * @brief Writes the remaining faces and the vertices they use back to a mesh
+ */
+void Decimator::write(Mesh &mesh) const {
+    std::vector<int> remap(points.size(), -1);
+    std::vector<Face> kept;
+    kept.reserve(liveFaces);
+    Mesh result;
+    for (uint32_t f = 0; f < faces.size(); f++) {
+        if (!faceAlive[f]) continue;
+        int corners[3];
+        for (int k = 0; k < 3; k++) {
+            const uint32_t v = faces[f][k];
+            if (remap[v] == -1) {
+                remap[v] = result.addVertex(static_cast<float>(points[v][0]), static_cast<float>(points[v][1]),
+                                            static_cast<float>(points[v][2]));
+            }
+            corners[k] = remap[v];
+        }
+        kept.emplace_back(corners[0], corners[1], corners[2]);
+    }
+    result.addFaces(kept);
+    mesh = std::move(result);
+}
+
+size_t decimateMesh(Mesh &mesh, const DecimateOptions &options) {
+    if ((options.maxTriangles == 0 && std::isinf(options.maxError)) || mesh.getFaces().size() <= options.maxTriangles) {
+        return 0;
+    }
+    Decimator decimator(mesh);
+    const size_t removed = decimator.run(options);
+    if (removed > 0) {
+        decimator.write(mesh);
+    }
+    return removed;
+}
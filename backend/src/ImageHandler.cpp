@@ -1,9 +1,12 @@
 #include <opencv2/opencv.hpp>
-#include <iostream>
 #include <string>
+#include <algorithm>
 #include "../header/ImageHandler.hpp"
 #include "../header/Color.hpp"
 #include "../header/ColorMap.hpp"
+#include "../header/ThreadBudget.hpp"
+#include "../header/Logger.hpp"
+#include "../header/Islands.hpp"
 
 /**
  * @brief Convert a color to a pixel
@@ -21,11 +24,15 @@ void colorToPixel(const Color &color, Vec4b &pixel) {
  * @return The color
  */
 Color pixelToColor(const cv::Vec4b &pixel) {
-    Color color;
-    color.setRed(pixel[2]);
-    color.setGreen(pixel[1]);
-    color.setBlue(pixel[0]);
-    return color;
+    return Color(pixelToPacked(pixel));
+}
+/**
+ * @brief Convert a pixel to a packed color
+ * @param pixel The pixel to convert
+ * @return The packed color
+ */
+PackedColor pixelToPacked(const cv::Vec4b &pixel) {
+    return PackedColor::fromBgra(&pixel[0]);
 }
 
 
@@ -39,7 +46,7 @@ void ImageHandler::readImage(const std::string &path) {
     image = cv::imread(path, cv::IMREAD_UNCHANGED);
 
     if (image.empty()) {
-        std::cerr << "Error: Could not read image at " << path << std::endl;
+        LOG_ERROR("Could not read image at ", path);
         return;
     }
     if (image.channels() == 3) {
@@ -65,8 +72,24 @@ void ImageHandler::setImage(const cv::Mat &img) {
 }
 
 
+/**
+ * @brief Work on an image in place
+ * The image becomes both the source and the working image, without a copy, so every
+ * step after this writes into its pixels. It must not be shared with the image cache.
+ * @param img The image, with four channels
+ * @throws runtime_error If the image does not have four channels
+ */
+void ImageHandler::setWorkingImage(Mat &img) {
+    if (img.channels() != 4) {
+        throw std::runtime_error("Unsupported image format");
+    }
+    image = img;
+    outputImage = img;
+}
+
+
 void ImageHandler::saveImage(const std::string &path) {
-    std::cout << "Saving image to " << path << std::endl;
+    LOG_INFO("Saving image to ", path);
     imwrite(path, outputImage);
 }
 /**
@@ -75,30 +98,40 @@ void ImageHandler::saveImage(const std::string &path) {
  * @param hsl if the method should use hsl distance
  */
 void ImageHandler::mapImage(const ColorMap &colorMap, bool hsl) {
-    std::cout << "Mapping image with " << colorMap.getColors().size() << " colors.\n";
-    for (const auto &color : colorMap.getColors()) {
-        std::cout << "Color: " << color.getHex() << "\n";
-    }
-    if (image.empty()) {
-        std::cerr << "Error: No image loaded.\n";
+    LOG_DEBUG("Mapping image with ", colorMap.getColors().size(), " colors");
+    if (outputImage.empty()) {
+        LOG_ERROR("No image loaded");
         return;
     }
-    cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range &range) {
+    std::vector<PackedColor> palette;
+    for (const auto &color : colorMap.getColors()) {
+        palette.push_back(color.getPacked());
+    }
+    cv::parallel_for_(cv::Range(0, outputImage.rows), [&](const cv::Range &range) {
+        std::vector<PackedColor> pixels(outputImage.cols);
+        std::vector<int> indices(outputImage.cols);
+
         for (int i = range.start; i < range.end; ++i) {
             auto* rowPtr = outputImage.ptr<cv::Vec4b>(i);
 
-            for (int j = 0; j < image.cols; j++) {
+            int count = 0;
+            for (int j = 0; j < outputImage.cols; j++) {
                 if (rowPtr[j][3] == 0) continue; // if transparent, don't do shit
+                pixels[count++] = pixelToPacked(rowPtr[j]);
+            }
+            colorMap.getClosestIndices(pixels.data(), indices.data(), count, hsl);
 
-                Color c = pixelToColor(rowPtr[j]);
-                Color mapped = colorMap.getClosestColor(c, hsl);
+            int k = 0;
+            for (int j = 0; j < outputImage.cols; j++) {
+                if (rowPtr[j][3] == 0) continue;
+                const PackedColor mapped = palette[indices[k++]];
 
-                rowPtr[j][0] = mapped.getBlue();
-                rowPtr[j][1] = mapped.getGreen();
-                rowPtr[j][2] = mapped.getRed();
+                rowPtr[j][0] = mapped.blue();
+                rowPtr[j][1] = mapped.green();
+                rowPtr[j][2] = mapped.red();
             }
         }
-    });
+    }, parallelStripes());
 }
 
 /**
@@ -119,117 +152,111 @@ void ImageHandler::mapImage(ColorMap &colorMap, const std::string &path) {
         mapImage(colorMap);
     }
 }
+/**
+ * @brief Smooth a color image with a guided filter that uses the image itself as guide
+ * Every channel is its own guide, so edges are kept where that channel changes. The filter
+ * only needs box filters, so the cost per pixel is the same for every radius.
+ * @param bgr The image, three channels of 8 bits
+ * @param radius The radius of the window
+ * @param epsilon The regularization, in squared intensities from 0 to 1; larger smooths stronger edges
+ * @return The smoothed image, three channels of 8 bits
+ */
+static cv::Mat guidedFilter(const cv::Mat &bgr, int radius, double epsilon) {
+    const cv::Size window(2 * radius + 1, 2 * radius + 1);
+    cv::Mat guide;
+    bgr.convertTo(guide, CV_32FC3, 1.0 / 255.0);
+
+    cv::Mat mean, meanSquare, a;
+    cv::boxFilter(guide, mean, CV_32F, window, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::multiply(guide, guide, meanSquare);
+    cv::boxFilter(meanSquare, meanSquare, CV_32F, window, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+
+    // a = variance / (variance + epsilon), b = mean * (1 - a), reusing the buffers
+    cv::Mat variance = meanSquare;
+    cv::multiply(mean, mean, a);
+    cv::subtract(variance, a, variance);
+    cv::add(variance, cv::Scalar::all(epsilon), a);
+    cv::divide(variance, a, a);
+    cv::Mat b = mean;
+    cv::multiply(a, mean, variance);
+    cv::subtract(mean, variance, b);
+
+    cv::boxFilter(a, a, CV_32F, window, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::boxFilter(b, b, CV_32F, window, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    cv::multiply(a, guide, guide);
+    cv::add(guide, b, guide);
+
+    cv::Mat result;
+    guide.convertTo(result, CV_8UC3, 255.0);
+    return result;
+}
+
 /**
  * @brief Blur the image
- * Blurs the image using a kernel of the given size. Useful for reducing noise before mapping.
- * @param kernelSize The size of the kernel
+ * Blurs the working image using a kernel of the given size. Useful for reducing noise before mapping.
+ * The alpha channel is kept as it is.
+ * @param kernelSize The size of the kernel in pixels
+ * @param colorSize How far apart colors may be and still be blurred together, the sigma
+ * of the bilateral filter is twice this; it does not change when the image is scaled
+ * @param mode The filter to blur with
  */
-void ImageHandler::blurImage(int kernelSize) {
-    if (image.empty()) {
-        std::cerr << "Error: No image loaded.\n";
+void ImageHandler::blurImage(int kernelSize, int colorSize, BlurMode mode) {
+    if (outputImage.empty()) {
+        LOG_ERROR("No image loaded");
         return;
     }
-    
-    // Handle transparency by separating alpha channel
-    if (image.channels() == 4) {
-        std::vector<cv::Mat> channels;
-        cv::split(image, channels);
-        
-        cv::Mat bgr;
-        std::vector<cv::Mat> bgrChannels = {channels[0], channels[1], channels[2]};
-        cv::merge(bgrChannels, bgr);
-        
-        cv::Mat blurred;
-        cv::bilateralFilter(bgr, blurred, kernelSize, kernelSize * 2, kernelSize / 2);
-        
-        std::vector<cv::Mat> blurredChannels;
-        cv::split(blurred, blurredChannels);
-        blurredChannels.push_back(channels[3]);
-        
-        cv::merge(blurredChannels, outputImage);
+    if (outputImage.channels() != 4) {
+        throw std::runtime_error("Unsupported image format");
+    }
+
+    cv::Mat bgr;
+    cv::cvtColor(outputImage, bgr, cv::COLOR_BGRA2BGR);
+
+    cv::Mat blurred;
+    if (mode == BlurMode::Guided) {
+        // the same color range as the sigma of the bilateral filter
+        const double sigmaColor = colorSize * 2 / 255.0;
+        blurred = guidedFilter(bgr, std::max(kernelSize / 2, 1), sigmaColor * sigmaColor);
     } else {
-        cv::bilateralFilter(image, outputImage, kernelSize, kernelSize * 2, kernelSize / 2);
+        cv::bilateralFilter(bgr, blurred, kernelSize, colorSize * 2, kernelSize / 2);
     }
-}
 
+    // write the blurred colors back in place, the alpha channel stays as it is
+    const int fromTo[] = {0, 0, 1, 1, 2, 2};
+    cv::mixChannels(&blurred, 1, &outputImage, 1, fromTo, 3);
+}
 
-// TODO make this work better, kinda ass rn.
 /**
- * @brief Remove small islands from the image
- * Removes small islands of color from the image. An island is a group of pixels of the same color.
- * @param islandSize The maximum size of an island to remove
+ * @brief Remove small islands from the mapped image
+ * Labels the mapped image with the palette, merges every island of fewer than
+ * minIslandSize pixels into the color it shares the longest border with and
+ * writes the new colors back. See removeIslands in Islands.hpp.
+ * @param colorMap The color map the image was mapped with
+ * @param minIslandSize The smallest island that is kept
+ * @return The number of islands that were removed
 */
-void ImageHandler::removeIslands(int islandSize) {
-    if (outputImage.empty() || islandSize <= 0) return;
+size_t ImageHandler::removeIslands(const ColorMap &colorMap, int minIslandSize) {
+    if (outputImage.empty() || minIslandSize <= 1) return 0;
 
-    cv::Mat visited = cv::Mat::zeros(outputImage.size(), CV_8U);
-    std::vector<std::pair<int, int>> directions = {{0,1},{1,0},{0,-1},{-1,0}};
+    const std::vector<Color> &colors = colorMap.getColors();
+    LabelImage labels = labelPixels(outputImage, colors);
+    const LabelImage original = labels;
+    const size_t removed = ::removeIslands(labels, minIslandSize);
+    if (removed == 0) return 0;
 
-    auto colorsEqual = [](const Vec4b &a, const Vec4b &b) {
-        return a == b;
-    };
-
-    auto floodFill = [&](int x, int y, const Vec4b &targetColor) {
-        std::vector<cv::Point> stack, islandPixels;
-        stack.push_back({x, y});
-        visited.at<uchar>(y, x) = 1;
-
-        while (!stack.empty()) {
-            cv::Point p = stack.back();
-            stack.pop_back();
-            islandPixels.push_back(p);
-
-            for (const auto &dir : directions) {
-                int nx = p.x + dir.first;
-                int ny = p.y + dir.second;
-                if (nx >= 0 && nx < outputImage.cols && ny >= 0 && ny < outputImage.rows &&
-                    !visited.at<uchar>(ny, nx)) {
-                    Vec4b currentColor = outputImage.at<Vec4b>(ny, nx);
-                    if (colorsEqual(currentColor, targetColor)) {
-                        stack.push_back({nx, ny});
-                        visited.at<uchar>(ny, nx) = 1;
-                    }
-                }
-            }
-        }
-        return islandPixels;
-    };
-
-    auto mostFrequentColor = [&](const std::vector<cv::Point> &points) -> Vec4b {
-        std::map<std::tuple<uchar, uchar, uchar>, int> colorCount;
-        for (const auto &p : points) {
-            for (const auto &dir : directions) {
-                int nx = p.x + dir.first;
-                int ny = p.y + dir.second;
-                if (nx >= 0 && nx < outputImage.cols && ny >= 0 && ny < outputImage.rows) {
-                    Vec4b color = outputImage.at<Vec4b>(ny, nx);
-                    colorCount[{color[0], color[1], color[2]}]++;
-                }
-            }
-        }
-        if (colorCount.empty()) return outputImage.at<Vec4b>(points.front().y, points.front().x);
-
-        auto maxElement = std::max_element(
-            colorCount.begin(), colorCount.end(),
-            [](const auto &a, const auto &b) { return a.second < b.second; }
-        );
-        return Vec4b(std::get<0>(maxElement->first), std::get<1>(maxElement->first), std::get<2>(maxElement->first), 255);
-    };
-
-    for (int y = 0; y < outputImage.rows; y++) {
-        for (int x = 0; x < outputImage.cols; x++) {
-            if (!visited.at<uchar>(y, x)) {
-                Vec4b targetColor = outputImage.at<Vec4b>(y, x);
-                auto island = floodFill(x, y, targetColor);
-                if (static_cast<int>(island.size()) <= islandSize) {
-                    Vec4b newColor = mostFrequentColor(island);
-                    for (const auto &p : island) {
-                        outputImage.at<Vec4b>(p.y, p.x) = newColor;
-                    }
+    cv::parallel_for_(cv::Range(0, outputImage.rows), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i) {
+            auto *rowPtr = outputImage.ptr<cv::Vec4b>(i);
+            const uint8_t *before = original.row(i + 1) + 1;
+            const uint8_t *after = labels.row(i + 1) + 1;
+            for (int j = 0; j < outputImage.cols; ++j) {
+                if (before[j] != after[j]) {
+                    colorToPixel(colors[after[j] - 1], rowPtr[j]);
                 }
             }
         }
-    }
+    }, parallelStripes());
+    return removed;
 }
 
 /**
@@ -241,35 +268,101 @@ void ImageHandler::removeIslands(int islandSize) {
  * @return the matrix
  */
 Matrix ImageHandler::getImageAsMatrix(const Color &color) {
-    Matrix m(image.rows+2, std::vector<int>(image.cols+2, 0));
+    Matrix m(outputImage.rows+2, std::vector<int>(outputImage.cols+2, 0));
+    const uint32_t target = color.getPacked().rgb();
 
-    cv::parallel_for_(cv::Range(0, image.rows),
+    cv::parallel_for_(cv::Range(0, outputImage.rows),
         [&](const cv::Range& range) {
             for (int i = range.start; i < range.end; ++i) {
-                const cv::Vec4b* rowPtr = image.ptr<cv::Vec4b>(i);
-                for (int j = 0; j < image.cols; ++j) {
+                const cv::Vec4b* rowPtr = outputImage.ptr<cv::Vec4b>(i);
+                for (int j = 0; j < outputImage.cols; ++j) {
                     if (rowPtr[j][3] == 0) continue;
-                    Color c = pixelToColor(rowPtr[j]);
-                    m[i+1][j+1] = (c == color) ? 1 : 0;
+                    m[i+1][j+1] = (pixelToPacked(rowPtr[j]).rgb() == target) ? 1 : 0;
                 }
             }
-        }
+        }, parallelStripes()
     );
 
     return m;
 }
 
+/**
+ * @brief returns a label image of the image given a color map
+ * Every pixel gets the label of the palette color it matches exactly, so all
+ * colors are found in one pass. Pixels that are transparent or do not match any
+ * color get label 0. If the palette has the same color twice, the first one is used.
+ *
+ * @param colorMap the colors to match with
+ * @return the label image, with a border of empty pixels
+ * @throws invalid_argument If the color map has more colors than labels fit in a byte
+ */
+LabelImage ImageHandler::getLabelImage(const ColorMap &colorMap) {
+    return labelPixels(outputImage, colorMap.getColors());
+}
+
+/**
+ * @brief labels every pixel of an image with its palette color
+ * @param source the image, with four channels
+ * @param colors the palette
+ * @return the label image, with a border of empty pixels
+ * @throws invalid_argument If the palette has more colors than labels fit in a byte
+ */
+LabelImage ImageHandler::labelPixels(const Mat &source, const std::vector<Color> &colors) {
+    if (colors.size() > LabelImage::maxLabels) {
+        throw std::invalid_argument("Too many colors for a label image");
+    }
+    // the palette sorted by color for a binary search, a repeated color keeps the label of its first occurrence
+    std::vector<std::pair<uint32_t, uint8_t>> palette;
+    for (size_t i = 0; i < colors.size(); i++) {
+        palette.emplace_back(colors[i].getPacked().rgb(), static_cast<uint8_t>(i + 1));
+    }
+    std::stable_sort(palette.begin(), palette.end(),
+                     [](const auto &a, const auto &b) { return a.first < b.first; });
+    palette.erase(std::unique(palette.begin(), palette.end(),
+                              [](const auto &a, const auto &b) { return a.first == b.first; }),
+                  palette.end());
+    const auto labelOf = [&palette](uint32_t rgb) -> uint8_t {
+        const auto match = std::lower_bound(palette.begin(), palette.end(), rgb,
+                                            [](const auto &entry, uint32_t value) { return entry.first < value; });
+        return match != palette.end() && match->first == rgb ? match->second : 0;
+    };
+
+    LabelImage labels(source.cols + 2, source.rows + 2);
+
+    cv::parallel_for_(cv::Range(0, source.rows),
+        [&](const cv::Range& range) {
+            for (int i = range.start; i < range.end; ++i) {
+                const cv::Vec4b* rowPtr = source.ptr<cv::Vec4b>(i);
+                uint8_t* labelRow = labels.row(i + 1) + 1;
+                // mapped images are mostly runs of one color, so the last lookup is reused
+                uint32_t lastRgb = 0;
+                uint8_t lastLabel = labelOf(lastRgb);
+                for (int j = 0; j < source.cols; ++j) {
+                    if (rowPtr[j][3] == 0) continue;
+                    const uint32_t rgb = pixelToPacked(rowPtr[j]).rgb();
+                    if (rgb != lastRgb) {
+                        lastRgb = rgb;
+                        lastLabel = labelOf(rgb);
+                    }
+                    labelRow[j] = lastLabel;
+                }
+            }
+        }, parallelStripes()
+    );
+
+    return labels;
+}
+
 /**
  * @brief downscales image to maxSize
  * @param maxSize the maximum width/height the image can have
  */
 void ImageHandler::downScaleImage(int maxSize) {
-
-    if (image.empty() || maxSize <= 0) {
+    if (outputImage.empty() || maxSize <= 0) {
         return;
     }
-    int width  = image.cols;
-    int height = image.rows;
+    int width  = outputImage.cols;
+    int height = outputImage.rows;
 
     int largest = std::max(width, height);
 
@@ -278,24 +371,12 @@ void ImageHandler::downScaleImage(int maxSize) {
     }
 
     double scale = static_cast<double>(maxSize) / largest;
-    int newWidth  = static_cast<int>(width  * scale);
-    int newHeight = static_cast<int>(height * scale);
-
-    cv::resize(
-        image,
-        image,
-        cv::Size(newWidth, newHeight),
-        0,
-        0,
-        cv::INTER_AREA
-    );    
-    cv::resize(
-        outputImage,
-        outputImage,
-        cv::Size(newWidth, newHeight),
-        0,
-        0,
-        cv::INTER_AREA
-    );
+    int newWidth  = std::max(1, static_cast<int>(width  * scale));
+    int newHeight = std::max(1, static_cast<int>(height * scale));
+
+    // only the working image is resized, the source image is not used after processing started
+    cv::Mat resized;
+    cv::resize(outputImage, resized, cv::Size(newWidth, newHeight), 0, 0, cv::INTER_AREA);
+    outputImage = resized;
 }
 
@@ -0,0 +1,159 @@
+#include "../header/ImagePipeline.hpp"
+#include "../header/ColorMap.hpp"
+#include "../header/Logger.hpp"
+#include "../header/Metrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief Constructor of a pipeline
+ * @param cache The cache of the downscaled and blurred images
+ * @param settings The settings of the run
+ */
+ImagePipeline::ImagePipeline(MatCache &cache, PipelineSettings settings) : cache(cache), settings(std::move(settings)) {}
+
+/**
+ * @brief Get the factor an image is downscaled by
+ * @param size The size of the decoded image
+ * @return The factor, 1 if the image already fits
+ */
+double ImagePipeline::downscaleFactor(const cv::Size &size) const {
+    const int largest = std::max(size.width, size.height);
+    if (settings.maxSize <= 0 || largest <= settings.maxSize) {
+        return 1.0;
+    }
+    return static_cast<double>(settings.maxSize) / largest;
+}
+
+/**
+ * @brief Get the blur kernel size on the downscaled image
+ * Only the size in pixels is scaled, the color range of the blur stays at the blur factor.
+ * @param scale The factor the image is downscaled by
+ * @return The kernel size, 0 for no blur
+ */
+int ImagePipeline::scaledBlurSize(double scale) const {
+    if (settings.blurFactor <= 0) {
+        return 0;
+    }
+    return std::max(1, static_cast<int>(std::lround(settings.blurFactor * scale)));
+}
+
+/**
+ * @brief Get the stages that run for an image
+ * Stages that would not change the image are left out.
+ * @param size The size of the decoded image
+ * @return The stages, in the order they run
+ */
+std::vector<PipelineStage> ImagePipeline::plan(const cv::Size &size) const {
+    std::vector<PipelineStage> stages;
+    for (PipelineStage stage : order) {
+        if ((stage == PipelineStage::Downscale && downscaleFactor(size) >= 1.0) ||
+            (stage == PipelineStage::Blur && settings.blurFactor <= 0) ||
+            (stage == PipelineStage::Cleanup && settings.minIslandSize <= 1)) {
+            continue;
+        }
+        stages.push_back(stage);
+    }
+    return stages;
+}
+
+/**
+ * @brief Copy a decoded image into a working buffer with four channels
+ * @throws runtime_error If the image does not have three or four channels
+ */
+static cv::Mat toWorkingBuffer(const cv::Mat &image) {
+    cv::Mat buffer;
+    if (image.channels() == 4) {
+        buffer = image.clone();
+    } else if (image.channels() == 3) {
+        cv::cvtColor(image, buffer, cv::COLOR_BGR2BGRA);
+    } else {
+        throw std::runtime_error("Unsupported image format");
+    }
+    return buffer;
+}
+
+/**
+ * @brief Run the pipeline
+ * @param decoded The decoded image, shared with the cache, it is not written to
+ * @param content The hash of the uploaded file, used in the cache keys
+ * @return The mapped image
+ */
+cv::Mat ImagePipeline::run(const cv::Mat &decoded, const ContentHash &content) const {
+    const double scale = downscaleFactor(decoded.size());
+    const int blurSize = scaledBlurSize(scale);
+    const MatCacheKey downscaledKey{content, static_cast<int>(PipelineStage::Downscale), {settings.maxSize, 0, 0}};
+    const MatCacheKey blurredKey{content, static_cast<int>(PipelineStage::Blur),
+                                 {settings.maxSize, settings.blurFactor, static_cast<int>(settings.blurMode)}};
+    const std::vector<PipelineStage> stages = plan(decoded.size());
+
+    // resume after the latest cached stage; cached images are shared, so the buffer starts as a copy
+    PipelineStage resumeAfter = PipelineStage::Decode;
+    cv::Mat buffer;
+    cv::Mat cached;
+    if (blurSize > 0 && cache.get(blurredKey, cached)) {
+        resumeAfter = PipelineStage::Blur;
+        buffer = cached.clone();
+    } else if (scale < 1.0 && cache.get(downscaledKey, cached)) {
+        resumeAfter = PipelineStage::Downscale;
+        buffer = cached.clone();
+    } else if (scale >= 1.0) {
+        buffer = toWorkingBuffer(decoded);
+    }
+
+    ImageHandler imageHandler = ImageHandler();
+    ColorMap colorMap = ColorMap(settings.colors);
+    for (PipelineStage stage : stages) {
+        if (stage <= resumeAfter) {
+            continue;
+        }
+        LOG_DEBUG("Pipeline stage ", stageName(stage));
+        switch (stage) {
+            case PipelineStage::Decode:
+                break;
+            case PipelineStage::Downscale: {
+                ScopedTimer timer(Stage::Downscale);
+                const int width = std::max(1, static_cast<int>(decoded.cols * scale));
+                const int height = std::max(1, static_cast<int>(decoded.rows * scale));
+                cv::Mat resized;
+                cv::resize(decoded, resized, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+                buffer = resized.channels() == 4 ? resized : toWorkingBuffer(resized);
+                cache.put(downscaledKey, buffer.clone());
+                break;
+            }
+            case PipelineStage::Blur: {
+                ScopedTimer timer(Stage::Blur);
+                imageHandler.setWorkingImage(buffer);
+                imageHandler.blurImage(blurSize, settings.blurFactor, settings.blurMode);
+                cache.put(blurredKey, buffer.clone());
+                break;
+            }
+            case PipelineStage::Map: {
+                ScopedTimer timer(Stage::Map);
+                imageHandler.setWorkingImage(buffer);
+                imageHandler.mapImage(colorMap, settings.hsl);
+                break;
+            }
+            case PipelineStage::Cleanup: {
+                ScopedTimer timer(Stage::Islands);
+                imageHandler.setWorkingImage(buffer);
+                imageHandler.removeIslands(colorMap, settings.minIslandSize);
+                break;
+            }
+        }
+    }
+    return buffer;
+}
+
+const char *ImagePipeline::stageName(PipelineStage stage) {
+    switch (stage) {
+        case PipelineStage::Decode: return "decode";
+        case PipelineStage::Downscale: return "downscale";
+        case PipelineStage::Blur: return "blur";
+        case PipelineStage::Map: return "map";
+        case PipelineStage::Cleanup: return "cleanup";
+    }
+    return "unknown";
+}
@@ -0,0 +1,196 @@
+#include "../header/Islands.hpp"
+#include "../header/ThreadBudget.hpp"
+#include <algorithm>
+#include <opencv2/core.hpp>
+
+// rows per strip of the parallel passes
+static constexpr int stripRows = 64;
+
+/**
+ * @brief Find the root of a pixel, halving the path on the way
+ * Parents always have a smaller index than their children, so the root is the
+ * first pixel of the component in scan order.
+ */
+static uint32_t findRoot(std::vector<uint32_t> &parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * @brief Join the components of two pixels under the smaller root
+ */
+static void unite(std::vector<uint32_t> &parent, uint32_t a, uint32_t b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+Components findComponents(const LabelView &labels, bool diagonal) {
+    Components components;
+    components.width = labels.width;
+    components.height = labels.height;
+    const int width = labels.width;
+    const int height = labels.height;
+    if (width <= 0 || height <= 0) {
+        return components;
+    }
+    std::vector<uint32_t> &parent = components.ids;
+    parent.resize(static_cast<size_t>(width) * height);
+
+    // first pass, every strip only links pixels inside itself so they do not touch the same parents
+    const int strips = (height + stripRows - 1) / stripRows;
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            const int firstRow = strip * stripRows;
+            const int lastRow = std::min(firstRow + stripRows, height);
+            for (int y = firstRow; y < lastRow; y++) {
+                const uint8_t *row = labels.row(y);
+                const uint8_t *above = y > firstRow ? labels.row(y - 1) : nullptr;
+                const uint32_t rowStart = static_cast<uint32_t>(y) * width;
+                for (int x = 0; x < width; x++) {
+                    const uint32_t i = rowStart + x;
+                    parent[i] = i;
+                    if (x > 0 && row[x - 1] == row[x]) {
+                        unite(parent, i, i - 1);
+                    }
+                    if (above && above[x] == row[x]) {
+                        unite(parent, i, i - width);
+                    }
+                    if (diagonal && above) {
+                        if (x > 0 && above[x - 1] == row[x]) unite(parent, i, i - width - 1);
+                        if (x + 1 < width && above[x + 1] == row[x]) unite(parent, i, i - width + 1);
+                    }
+                }
+            }
+        }
+    }, parallelStripes(strips));
+
+    // merge the components that touch across the strip borders
+    for (int y = stripRows; y < height; y += stripRows) {
+        const uint8_t *row = labels.row(y);
+        const uint8_t *above = labels.row(y - 1);
+        const uint32_t rowStart = static_cast<uint32_t>(y) * width;
+        for (int x = 0; x < width; x++) {
+            if (above[x] == row[x]) {
+                unite(parent, rowStart + x, rowStart + x - width);
+            }
+            if (diagonal) {
+                if (x > 0 && above[x - 1] == row[x]) unite(parent, rowStart + x, rowStart + x - width - 1);
+                if (x + 1 < width && above[x + 1] == row[x]) unite(parent, rowStart + x, rowStart + x - width + 1);
+            }
+        }
+    }
+
+    // second pass, in scan order the parent of a pixel already holds the id of its
+    // component, so one sweep replaces every parent by a compact id
+    for (uint32_t i = 0; i < parent.size(); i++) {
+        uint32_t id;
+        if (parent[i] == i) {
+            id = static_cast<uint32_t>(components.sizes.size());
+            components.sizes.push_back(0);
+            components.labels.push_back(labels.at(static_cast<int>(i % width), static_cast<int>(i / width)));
+        } else {
+            id = parent[parent[i]];
+        }
+        parent[i] = id;
+        components.sizes[id]++;
+    }
+    return components;
+}
+
+size_t removeIslands(LabelImage &labels, int minIslandSize) {
+    if (minIslandSize <= 1 || labels.labels.empty()) {
+        return 0;
+    }
+    const Components components = findComponents(labels);
+    const int width = labels.width;
+    const int height = labels.height;
+    auto isIsland = [&](uint32_t id) {
+        return components.labels[id] != 0 && components.sizes[id] < static_cast<uint32_t>(minIslandSize);
+    };
+
+    // one sweep over every pair of neighbors records the borders of the islands as
+    // (island, neighbor label, neighbor is not an island), packed to sort them
+    const int strips = (height + stripRows - 1) / stripRows;
+    std::vector<std::vector<uint64_t>> stripBorders(strips);
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            std::vector<uint64_t> &borders = stripBorders[strip];
+            auto record = [&](uint32_t island, uint32_t neighbor) {
+                if (isIsland(island) && components.labels[neighbor] != 0) {
+                    borders.push_back((uint64_t(island) << 9) | (uint64_t(components.labels[neighbor]) << 1) |
+                                      (isIsland(neighbor) ? 0 : 1));
+                }
+            };
+            const int firstRow = strip * stripRows;
+            const int lastRow = std::min(firstRow + stripRows, height);
+            for (int y = firstRow; y < lastRow; y++) {
+                const uint32_t *ids = components.ids.data() + static_cast<size_t>(y) * width;
+                const uint32_t *below = y + 1 < height ? ids + width : nullptr;
+                for (int x = 0; x < width; x++) {
+                    if (x + 1 < width && ids[x] != ids[x + 1]) {
+                        record(ids[x], ids[x + 1]);
+                        record(ids[x + 1], ids[x]);
+                    }
+                    if (below && ids[x] != below[x]) {
+                        record(ids[x], below[x]);
+                        record(below[x], ids[x]);
+                    }
+                }
+            }
+        }
+    }, parallelStripes(strips));
+
+    std::vector<uint64_t> borders;
+    for (auto &strip : stripBorders) {
+        borders.insert(borders.end(), strip.begin(), strip.end());
+        std::vector<uint64_t>().swap(strip);
+    }
+    std::sort(borders.begin(), borders.end());
+
+    // pick the label of every island, longest border with a kept neighbor first, then longest border at all
+    std::vector<uint8_t> replacement(components.count(), 0);
+    size_t removed = 0;
+    for (size_t i = 0; i < borders.size();) {
+        const uint32_t island = static_cast<uint32_t>(borders[i] >> 9);
+        uint8_t best = 0;
+        size_t bestKept = 0;
+        size_t bestAll = 0;
+        while (i < borders.size() && (borders[i] >> 9) == island) {
+            const uint64_t key = borders[i] >> 1;
+            size_t kept = 0;
+            size_t all = 0;
+            for (; i < borders.size() && (borders[i] >> 1) == key; i++) {
+                kept += borders[i] & 1;
+                all++;
+            }
+            if (kept > bestKept || (kept == bestKept && all > bestAll)) {
+                best = static_cast<uint8_t>(key);
+                bestKept = kept;
+                bestAll = all;
+            }
+        }
+        replacement[island] = best;
+        removed++;
+    }
+
+    cv::parallel_for_(cv::Range(0, height), [&](const cv::Range &range) {
+        for (int y = range.start; y < range.end; y++) {
+            uint8_t *row = labels.row(y);
+            const uint32_t *ids = components.ids.data() + static_cast<size_t>(y) * width;
+            for (int x = 0; x < width; x++) {
+                if (const uint8_t label = replacement[ids[x]]) {
+                    row[x] = label;
+                }
+            }
+        }
+    }, parallelStripes());
+    return removed;
+}
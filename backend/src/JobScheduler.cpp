@@ -0,0 +1,108 @@
+#include "../header/JobScheduler.hpp"
+#include "../header/ThreadBudget.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+/**
+ * @brief Constructor of the scheduler, starts the workers
+ * @param workers The number of jobs that run at the same time
+ * @param queueCapacity The number of jobs that may wait for a worker
+ * @param threadsPerJob The thread budget of every job, 0 for no limit
+ * @throws invalid_argument If there are no workers
+ */
+JobScheduler::JobScheduler(int workers, size_t queueCapacity, int threadsPerJob)
+    : capacity(queueCapacity), threadsPerJob(std::max(threadsPerJob, 0)) {
+    if (workers <= 0) {
+        throw std::invalid_argument("Job scheduler needs at least one worker");
+    }
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(&JobScheduler::work, this);
+    }
+}
+
+/**
+ * @brief Destructor of the scheduler
+ * Jobs that are already queued still run, so nobody waits on a job that never finishes.
+ */
+JobScheduler::~JobScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Queue a job
+ * @param job The job to run on a worker
+ * @return False if the queue is full and the job was not queued
+ */
+bool JobScheduler::trySubmit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // a job that can start right away does not count against the queue
+        if (stopping || queue.size() + running >= capacity + threads.size()) {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        queue.push_back(std::move(job));
+    }
+    available.notify_one();
+    return true;
+}
+
+/**
+ * @brief Estimate when a refused job could be queued again
+ * Based on the average duration of the recent jobs and the number of jobs ahead.
+ * @return The time for a Retry-After header, at least one second
+ */
+std::chrono::seconds JobScheduler::getRetryAfter() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const double waves = static_cast<double>(queue.size() + 1) / threads.size();
+    return std::chrono::seconds(std::max<long long>(1, static_cast<long long>(std::ceil(waves * averageSeconds))));
+}
+
+size_t JobScheduler::getQueued() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
+
+int JobScheduler::getRunning() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return running;
+}
+
+/**
+ * @brief The loop of a worker thread
+ * Takes jobs until the scheduler stops and the queue is empty.
+ */
+void JobScheduler::work() {
+    ScopedThreadBudget budget(threadsPerJob);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        available.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return;
+        }
+        std::function<void()> job = std::move(queue.front());
+        queue.pop_front();
+        running++;
+        lock.unlock();
+
+        const auto start = std::chrono::steady_clock::now();
+        try {
+            job();
+        } catch (...) {
+            // a failing job must not take the worker down with it
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        lock.lock();
+        running--;
+        averageSeconds = 0.8 * averageSeconds + 0.2 * elapsed.count();
+    }
+}
@@ -0,0 +1,141 @@
+#include "../header/Logger.hpp"
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+/**
+ * @brief Constructor of the logger, starts the flusher
+ * @param capacity The number of messages the ring buffer holds
+ */
+Logger::Logger(size_t capacity) : ring(capacity > 0 ? capacity : 1) {
+    flusher = std::thread(&Logger::run, this);
+}
+
+/**
+ * @brief Destructor of the logger
+ * Writes the messages that are still buffered before the flusher stops.
+ */
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    flusher.join();
+}
+
+/**
+ * @brief Formats the time and level prefix of a message
+ */
+static std::string prefix(LogLevel level) {
+    const auto now = std::chrono::system_clock::now();
+    const std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    const int millis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+    std::tm utc{};
+    gmtime_r(&seconds, &utc);
+    char buffer[40];
+    const size_t length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(buffer + length, sizeof(buffer) - length, ".%03dZ ", millis);
+    return std::string(buffer) + Logger::levelName(level) + " ";
+}
+
+/**
+ * @brief Queue a message
+ * Use the LOG_ macros instead, they skip disabled levels without formatting the message.
+ * @param level The level of the message
+ * @param message The message, without a line break
+ */
+void Logger::write(LogLevel level, std::string message) {
+    std::string line = prefix(level);
+    line += message;
+    line += '\n';
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (count == ring.size()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ring[(head + count) % ring.size()] = std::move(line);
+        count++;
+        queued++;
+    }
+    wake.notify_one();
+}
+
+/**
+ * @brief Wait until every message queued so far is written
+ */
+void Logger::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    const uint64_t target = queued;
+    wake.notify_one();
+    drained.wait(lock, [&] { return written >= target || stopping; });
+}
+
+/**
+ * @brief The loop of the flusher thread
+ * Takes everything in the ring at once and writes it with one call, outside the lock.
+ */
+void Logger::run() {
+    std::vector<std::string> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || count > 0; });
+        if (count == 0 && stopping) {
+            drained.notify_all();
+            return;
+        }
+        while (count > 0) {
+            batch.push_back(std::move(ring[head]));
+            head = (head + 1) % ring.size();
+            count--;
+        }
+        lock.unlock();
+
+        std::string text;
+        for (const auto &line : batch) {
+            text += line;
+        }
+        std::fwrite(text.data(), 1, text.size(), stdout);
+        std::fflush(stdout);
+
+        lock.lock();
+        written += batch.size();
+        batch.clear();
+        drained.notify_all();
+    }
+}
+
+const char *Logger::levelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return "DEBUG";
+        case LogLevel::Info: return "INFO";
+        case LogLevel::Warning: return "WARNING";
+        case LogLevel::Error: return "ERROR";
+        case LogLevel::Off: return "OFF";
+    }
+    return "UNKNOWN";
+}
+
+/**
+ * @brief Parse a level name, in any case
+ * @param name debug, info, warning, error or off
+ * @return The level, or nothing if the name is unknown
+ */
+std::optional<LogLevel> Logger::parseLevel(const std::string &name) {
+    std::string lower;
+    for (char c : name) {
+        lower += static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    }
+    if (lower == "debug") return LogLevel::Debug;
+    if (lower == "info") return LogLevel::Info;
+    if (lower == "warning" || lower == "warn") return LogLevel::Warning;
+    if (lower == "error") return LogLevel::Error;
+    if (lower == "off") return LogLevel::Off;
+    return std::nullopt;
+}
+
+Logger &logger() {
+    static Logger instance;
+    return instance;
+}
@@ -1,13 +1,43 @@
 #include "../header/MarchingSquare.hpp"
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include "../header/ThreadBudget.hpp"
 
 /**
  * @brief The constructor of the marching square
+ * Copies the 1s of the matrix into the occupancy grid.
  */
-MarchingSquare::MarchingSquare(Matrix matrix, int w, int h) {
-    m = matrix;
+MarchingSquare::MarchingSquare(const Matrix &matrix, int w, int h) : occupancy(static_cast<size_t>(w) * h) {
     width = w;
     height = h;
-    vertsFromMatrix();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            occupancy[static_cast<size_t>(y) * w + x] = matrix[y][x] == 1;
+        }
+    }
+    size = (sqrt(width*height))/5;
+    gridWidth = width * 2;
+}
+
+/**
+ * @brief The constructor of the marching square
+ * @param labels the label grid to march, only read during construction
+ * @param label the label of the pixels that are inside the mesh
+ * @param mergeFaces if full cells are merged into rectangles, see MergedRect
+ */
+MarchingSquare::MarchingSquare(const LabelView &labels, uint8_t label, bool mergeFaces)
+    : mergeFaces(mergeFaces), occupancy(static_cast<size_t>(labels.width) * labels.height) {
+    width = labels.width;
+    height = labels.height;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = labels.row(y);
+        uint8_t *occupied = occupancy.data() + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; x++) {
+            occupied[x] = row[x] == label;
+        }
+    }
+    size = (sqrt(width*height))/5;
+    gridWidth = width * 2;
 }
 
 /**
@@ -16,157 +46,358 @@ MarchingSquare::MarchingSquare(Matrix matrix, int w, int h) {
  * @param startY the y value of the top left corner
  * @return the index to use
  */
-int MarchingSquare::indexFromMatrix(int startX, int startY){
-    int index = m[startY][startX] == 1;
-    index += (m[startY][startX+1] == 1)*2;
-    index += (m[startY+1][startX+1] == 1)*4;
-    index += (m[startY+1][startX] == 1)*8;
-    return index;
+int MarchingSquare::indexFromMatrix(int startX, int startY) const {
+    const uint8_t *top = occupancy.data() + static_cast<size_t>(startY) * width + startX;
+    const uint8_t *bottom = top + width;
+    return top[0] | (top[1] << 1) | (bottom[1] << 2) | (bottom[0] << 3);
 }
 
 /**
- * @brief adds verticies from a square
+ * @brief records a vertex the first time the band uses it
+ * @param x the x value in the doubled grid
+ * @param y the y value in the doubled grid
+ * @param firstGridRow the first row of the doubled grid covered by the band
+ * @param used the grid points of the band already used
+ * @param created the grid positions of the verticies in the order they were first used
+ */
+void MarchingSquare::useVert(int x, int y, int firstGridRow, vector<uint8_t> &used, vector<size_t> &created) const {
+    uint8_t &isUsed = used[static_cast<size_t>(y - firstGridRow) * gridWidth + x];
+    if (!isUsed) {
+        isUsed = 1;
+        created.push_back(static_cast<size_t>(y) * gridWidth + x);
+    }
+}
+
+/**
+ * @brief finds the verticies used by a square
+ * Verticies are recorded the first time the band uses them, in the order the
+ * squares are visited.
  * @param startX the x value of the top left corner
  * @param startY the y value of the top left corner
- * @param size the thickness of the model
+ * @param firstGridRow the first row of the doubled grid covered by the band
+ * @param used the grid points of the band already used
+ * @param created the grid positions of the verticies in the order they were first used
  */
-void MarchingSquare::addVertsFromSquare(int startX, int startY, float size){
+void MarchingSquare::addVertsFromSquare(int startX, int startY, int firstGridRow, vector<uint8_t> &used, vector<size_t> &created) const {
     const int vx = startX * 2;
     const int vy = startY * 2;
     const int index = indexFromMatrix(startX, startY);
-    const int l = vertLookup[index].size();
 
-    for (int i = 0; i < l; i++) {
-        const Vert2 d = vertLookup[index][i];
-        const int x = vx + d[0];
-        const int y = vy + d[1];
+    for (const Vert2 &d : vertLookup[index]) {
+        useVert(vx + d[0], vy + d[1], firstGridRow, used, created);
+    }
+}
+
+/**
+ * @brief greedily merges the cells of a band into rectangles
+ * A rectangle of full cells starts at the first full cell that is not covered yet,
+ * grows to the right as far as the cells are full and then down as far as whole rows are.
+ * Half cells along a horizontal edge are merged to the right and half cells along a
+ * vertical edge downwards, as long as the edge stays straight; single half cells are
+ * left to the lookup tables. The rectangles are found in the order of their top left cell.
+ * @param firstRow the first cell row of the band
+ * @param lastRow the cell row after the band
+ * @param bandRects output, the rectangles of the band
+ * @param covered output, set for every cell of the band that is part of a rectangle
+ */
+void MarchingSquare::findRects(int firstRow, int lastRow, vector<MergedRect> &bandRects, uint8_t *covered) const {
+    const int cellCols = width - 1;
+    auto isFree = [&](int x, int y, int index) {
+        return !covered[static_cast<size_t>(y - firstRow) * cellCols + x] && indexFromMatrix(x, y) == index;
+    };
+    auto cover = [&](int left, int top, int right, int bottom) {
+        for (int y = top; y < bottom; y++) {
+            std::fill_n(covered + static_cast<size_t>(y - firstRow) * cellCols + left, right - left, 1);
+        }
+    };
+
+    for (int i = firstRow; i < lastRow; i++) {
+        for (int j = 0; j < cellCols; j++) {
+            const int index = indexFromMatrix(j, i);
+            if (covered[static_cast<size_t>(i - firstRow) * cellCols + j]) continue;
 
-        if (vertRef[y][x][0] == -1) {
-            vertRef[y][x][0] = mesh.addVertex(x - width + 1, y - height + 1, -size/2);
-            vertRef[y][x][1] = mesh.addVertex(x - width + 1, y - height + 1, size/2);
+            if (index == 15) {
+                int right = j + 1;
+                while (right < cellCols && isFree(right, i, 15)) right++;
+                int bottom = i + 1;
+                while (bottom < lastRow) {
+                    int x = j;
+                    while (x < right && isFree(x, bottom, 15)) x++;
+                    if (x < right) break;
+                    bottom++;
+                }
+                cover(j, i, right, bottom);
+                bandRects.push_back({j * 2, i * 2, right * 2, bottom * 2, 15});
+                j = right - 1;
+            } else if (index == 3 || index == 12) {
+                int right = j + 1;
+                while (right < cellCols && isFree(right, i, index)) right++;
+                if (right - j < 2) continue;
+                cover(j, i, right, i + 1);
+                bandRects.push_back({j * 2, i * 2, right * 2, i * 2 + 2, index});
+                j = right - 1;
+            } else if (index == 6 || index == 9) {
+                int bottom = i + 1;
+                while (bottom < lastRow && isFree(j, bottom, index)) bottom++;
+                if (bottom - i < 2) continue;
+                cover(j, i, j + 1, bottom);
+                bandRects.push_back({j * 2, i * 2, j * 2 + 2, bottom * 2, index});
+            }
         }
     }
 }
 
 /**
  * @brief adds verts for all squares in the matrix
+ * The bands are searched for verticies in parallel, then stitched together in
+ * band order. A vertex on the border between two bands is kept only in the first
+ * band, which gives the same vertex order as visiting every square in sequence.
+ * The bottom and top vertex of a point are added together, so only the index of
+ * the bottom one is stored.
  */
 void MarchingSquare::vertsFromMatrix(){
-    float size = (sqrt(width*height))/5;
-    int gridWidth  = width * 2;
-    int gridHeight = height * 2;   
-
-    vector<vector<vector<int>>> Ref(
-        gridHeight,
-        vector<vector<int>>(
-            gridWidth,
-            vector<int>(2, -1)
-        )
-    ); 
-    vertRef = Ref;
-
-    for (int i = 0; i<height-1; i++) {
-        for (int j = 0; j<width-1; j++) {
-            addVertsFromSquare(j,i, size);
+    const int gridHeight = height * 2;
+    vertRef.assign(static_cast<size_t>(gridWidth) * gridHeight, -1);
+
+    const int cellRows = height - 1;
+    const int bands = (cellRows + bandRows - 1) / bandRows;
+    vector<vector<size_t>> created(bands);
+    rects.assign(mergeFaces ? bands : 0, {});
+    mergedCells.assign(mergeFaces ? static_cast<size_t>(cellRows) * (width - 1) : 0, 0);
+
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range) {
+        for (int band = range.start; band < range.end; band++) {
+            const int firstRow = band * bandRows;
+            const int lastRow = std::min(firstRow + bandRows, cellRows);
+            vector<uint8_t> used(static_cast<size_t>(2 * (lastRow - firstRow) + 1) * gridWidth, 0);
+            if (mergeFaces) {
+                findRects(firstRow, lastRow, rects[band], mergedCells.data() + static_cast<size_t>(firstRow) * (width - 1));
+            }
+            // merged cells only add the corners of their rectangle, at its top left cell
+            size_t nextRect = 0;
+            for (int i = firstRow; i < lastRow; i++) {
+                for (int j = 0; j < width-1; j++) {
+                    if (mergeFaces && mergedCells[static_cast<size_t>(i) * (width - 1) + j]) {
+                        const vector<MergedRect> &bandRects = rects[band];
+                        if (nextRect < bandRects.size() && bandRects[nextRect].x0 == j * 2 && bandRects[nextRect].y0 == i * 2) {
+                            const auto [x0, y0, x1, y1] = bandRects[nextRect++].face();
+                            useVert(x0, y0, firstRow * 2, used, created[band]);
+                            useVert(x1, y0, firstRow * 2, used, created[band]);
+                            useVert(x1, y1, firstRow * 2, used, created[band]);
+                            useVert(x0, y1, firstRow * 2, used, created[band]);
+                        }
+                        continue;
+                    }
+                    addVertsFromSquare(j, i, firstRow * 2, used, created[band]);
+                }
+            }
+        }
+    }, parallelStripes(bands));
+
+    for (const auto &positions : created) {
+        for (const size_t pos : positions) {
+            int32_t &ref = vertRef[pos];
+            if (ref != -1) continue;
+            const int x = static_cast<int>(pos % gridWidth);
+            const int y = static_cast<int>(pos / gridWidth);
+            ref = mesh.addVertex(x - width + 1, y - height + 1, -size/2);
+            mesh.addVertex(x - width + 1, y - height + 1, size/2);
         }
-    } 
+    }
+    if (!mergeFaces) return;
+
+    // now that every vertex is known, pick how each rectangle is fanned
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range) {
+        vector<int32_t> outline;
+        array<size_t, 4> corners;
+        for (int band = range.start; band < range.end; band++) {
+            for (MergedRect &rect : rects[band]) {
+                rectOutline(rect, outline, corners);
+                // the number of verticies between the corners on the top, right, bottom and left side
+                const size_t inner[4] = {corners[1] - corners[0] - 1, corners[2] - corners[1] - 1,
+                                         corners[3] - corners[2] - 1, outline.size() - corners[3] - 1};
+                for (int corner = 0; corner < 4; corner++) {
+                    if (inner[corner] == 0 && inner[(corner + 3) % 4] == 0) {
+                        rect.fanCorner = corner;
+                        break;
+                    }
+                }
+            }
+        }
+    }, parallelStripes(bands));
+
+    for (auto &bandRects : rects) {
+        for (MergedRect &rect : bandRects) {
+            if (rect.fanCorner >= 0) continue;
+            const auto [x0, y0, x1, y1] = rect.face();
+            const float x = (x0 + x1) / 2.0f - width + 1;
+            const float y = (y0 + y1) / 2.0f - height + 1;
+            rect.center = mesh.addVertex(x, y, -size/2);
+            mesh.addVertex(x, y, size/2);
+        }
+    }
+}
+
+/**
+ * @brief gets the outline of the top and bottom face of a rectangle
+ * The outline runs clockwise in the grid from the top left corner, which is counter
+ * clockwise seen from above the mesh, and holds every vertex on the border.
+ * @param rect the rectangle
+ * @param outline output, the bottom verticies of the outline
+ * @param corners output, the positions of the top left, top right, bottom right and bottom left corner in the outline
+ */
+void MarchingSquare::rectOutline(const MergedRect &rect, vector<int32_t> &outline, array<size_t, 4> &corners) const {
+    outline.clear();
+    const auto add = [&](int x, int y) {
+        const int32_t ref = vertRef[static_cast<size_t>(y) * gridWidth + x];
+        if (ref != -1) outline.push_back(ref);
+    };
+    const auto [x0, y0, x1, y1] = rect.face();
+    corners[0] = outline.size();
+    for (int x = x0; x < x1; x++) add(x, y0);
+    corners[1] = outline.size();
+    for (int y = y0; y < y1; y++) add(x1, y);
+    corners[2] = outline.size();
+    for (int x = x1; x > x0; x--) add(x, y1);
+    corners[3] = outline.size();
+    for (int y = y1; y > y0; y--) add(x0, y);
+}
+
+/**
+ * @brief makes the faces of a rectangle
+ * The side of a strip is the side of one of its cells, stretched over the whole strip.
+ * @param rect the rectangle
+ * @param faces the faces of the band the rectangle is in
+ * @param outline scratch space for the outline
+ */
+void MarchingSquare::marchRect(const MergedRect &rect, vector<Face> &faces, vector<int32_t> &outline) const {
+    array<size_t, 4> corners;
+    rectOutline(rect, outline, corners);
+    const size_t n = outline.size();
+
+    if (rect.fanCorner >= 0) {
+        const size_t start = corners[rect.fanCorner];
+        const int32_t apex = outline[start];
+        for (size_t k = 1; k + 1 < n; k++) {
+            const int32_t a = outline[(start + k) % n];
+            const int32_t b = outline[(start + k + 1) % n];
+            faces.emplace_back(apex + 1, a + 1, b + 1);
+            faces.emplace_back(apex, b, a);
+        }
+    } else {
+        for (size_t k = 0; k < n; k++) {
+            const int32_t a = outline[k];
+            const int32_t b = outline[(k + 1) % n];
+            faces.emplace_back(rect.center + 1, a + 1, b + 1);
+            faces.emplace_back(rect.center, b, a);
+        }
+    }
+
+    // 0 and 2 are the ends of the strip, 1 is the middle of its short side
+    const auto stretch = [](int d, int low, int high) { return d == 0 ? low : d == 2 ? high : low + 1; };
+    for (const auto &tri : sideFaceLookup[rect.index]) {
+        int v[3];
+        for (int i = 0; i < 3; i++) {
+            const auto &[dx, dy, dz] = tri[i];
+            const int x = stretch(dx, rect.x0, rect.x1);
+            const int y = stretch(dy, rect.y0, rect.y1);
+            v[i] = vertRef[static_cast<size_t>(y) * gridWidth + x] + dz;
+        }
+        faces.emplace_back(v[0], v[1], v[2]);
+    }
 }
 
 /**
  * @brief marches the square starting in startX and startY
  * @param startX the x value of the top left corner
  * @param startY the y value of the top left corner
+ * @param faces the faces of the band the square is in
  */
-void MarchingSquare::marchSquare(int startX, int startY){
+void MarchingSquare::marchSquare(int startX, int startY, vector<Face> &faces) const {
     int index = indexFromMatrix(startX,startY);
     const int baseX = startX * 2;
     const int baseY = startY * 2;
 
     const auto& vl = vertLookup[index];
+    const auto ref = [&](int dx, int dy, int z) {
+        return vertRef[static_cast<size_t>(baseY + dy) * gridWidth + baseX + dx] + z;
+    };
 
     for (const Tri& offsets : topFaceLookup[index]) {
         int v[3];
-
         for (int i = 0; i < 3; i++) {
             const auto& [dx, dy] = vl[offsets[i]];
-            const int x = baseX + dx;
-            const int y = baseY + dy;
-            const int z = 1;
-
-            int& ref = vertRef[y][x][z];
-            if (ref == -1) {
-                float size = (sqrt(width*height))/5;
-                ref = mesh.addVertex(
-                    x - width + 1,
-                    y - height + 1,
-                    +size * 0.5f
-                );
-            }
-            v[i] = ref;
+            v[i] = ref(dx, dy, 1);
         }
-
-        mesh.addFace(v[0], v[1], v[2]);
+        faces.emplace_back(v[0], v[1], v[2]);
     }
 
     for (const Tri& offsets : bottomFaceLookup[index]) {
         int v[3];
-
         for (int i = 0; i < 3; i++) {
             const auto& [dx, dy] = vl[offsets[i]];
-            const int x = baseX + dx;
-            const int y = baseY + dy;
-            const int z = 0;
-
-            int& ref = vertRef[y][x][z];
-            if (ref == -1) {
-                float size = (sqrt(width*height))/5;
-                ref = mesh.addVertex(
-                    x - width + 1,
-                    y - height + 1,
-                    -size * 0.5f
-                );
-            }
-            v[i] = ref;
+            v[i] = ref(dx, dy, 0);
         }
-
-        mesh.addFace(v[0], v[1], v[2]);
+        faces.emplace_back(v[0], v[1], v[2]);
     }
 
     for (const auto& tri : sideFaceLookup[index]) {
         int v[3];
-
         for (int i = 0; i < 3; i++) {
             const auto& [dx, dy, dz] = tri[i];
-            const int x = baseX + dx;
-            const int y = baseY + dy;
-            const int z = dz;
-
-            int& ref = vertRef[y][x][z];
-            if (ref == -1) {
-                float size = (sqrt(width*height))/5;
-                ref = mesh.addVertex(
-                    x - width + 1,
-                    y - height + 1,
-                    dz ? +size * 0.5f : -size * 0.5f
-                );
-            }
-            v[i] = ref;
+            v[i] = ref(dx, dy, dz);
         }
-
-        mesh.addFace(v[0], v[1], v[2]);
+        faces.emplace_back(v[0], v[1], v[2]);
     }
 }
 
 /**
  * @brief marches all squares in the matrix
+ * The grid is split into bands of bandRows rows that are marched in parallel,
+ * each into its own face list. The lists are joined in band order, so the mesh
+ * is the same no matter how many threads are used.
  */
 void MarchingSquare::marchSquares() {
-    for (int i = 0; i < m.size()-1; i++) {
-        for (int j = 0; j < m[0].size()-1; j++) {
-            marchSquare(j,i);
+    vertsFromMatrix();
+
+    const int cellRows = height - 1;
+    const int bands = (cellRows + bandRows - 1) / bandRows;
+    vector<vector<Face>> faces(bands);
+
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range) {
+        vector<int32_t> outline;
+        for (int band = range.start; band < range.end; band++) {
+            const int firstRow = band * bandRows;
+            const int lastRow = std::min(firstRow + bandRows, cellRows);
+            size_t nextRect = 0;
+            for (int i = firstRow; i < lastRow; i++) {
+                for (int j = 0; j < width-1; j++) {
+                    if (mergeFaces && mergedCells[static_cast<size_t>(i) * (width - 1) + j]) {
+                        const vector<MergedRect> &bandRects = rects[band];
+                        if (nextRect < bandRects.size() && bandRects[nextRect].x0 == j * 2 && bandRects[nextRect].y0 == i * 2) {
+                            marchRect(bandRects[nextRect++], faces[band], outline);
+                        }
+                        continue;
+                    }
+                    marchSquare(j, i, faces[band]);
+                }
+            }
         }
+    }, parallelStripes(bands));
+
+    for (auto &bandFaces : faces) {
+        mesh.addFaces(bandFaces);
+        vector<Face>().swap(bandFaces);
     }
+}
 
+/**
+ * @brief reduces the triangles of the marched mesh
+ * @param options the triangle budget and error tolerance
+ * @return the number of triangles that were removed
+ */
+size_t MarchingSquare::decimate(const DecimateOptions &options) {
+    return decimateMesh(mesh, options);
 }
 
 /**
@@ -184,4 +415,12 @@ void MarchingSquare::exportMesh(string &filename){
  */
 string MarchingSquare::getMeshString() {
     return mesh.toString();
-}
\ No newline at end of file
+}
+
+/**
+ * @brief gets the mesh as binary stl
+ * @return the bytes of the binary stl
+ */
+string MarchingSquare::getMeshBinary() const {
+    return mesh.toBinarySTL();
+}
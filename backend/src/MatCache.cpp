@@ -0,0 +1,227 @@
+#include "../header/MatCache.hpp"
+#include <cstring>
+
+static constexpr uint64_t fnvPrime = 1099511628211ULL;
+
+/**
+ * @brief Constructor of the cache
+ * @param budgetBytes The most pixel memory the cached images may take
+ */
+MatCache::MatCache(size_t budgetBytes) : budget(budgetBytes) {}
+
+/**
+ * @brief Look up an image
+ * A hit makes the image the most recently used one.
+ * @param key The key of the image
+ * @param image Output, the cached image, only set on a hit
+ * @return True on a hit
+ */
+bool MatCache::get(const MatCacheKey &key, cv::Mat &image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    image = it->second->image;
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief Store an image
+ * Least recently used images are dropped until the cache fits its budget again.
+ * Images larger than the whole budget are not stored.
+ * @param key The key of the image
+ * @param image The image, shared with the cache
+ */
+void MatCache::put(const MatCacheKey &key, const cv::Mat &image) {
+    const size_t size = image.total() * image.elemSize();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size == 0 || size > budget) {
+        return;
+    }
+    auto it = index.find(key);
+    if (it != index.end()) {
+        bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    entries.push_front({key, image, size});
+    index[key] = entries.begin();
+    bytes += size;
+    evict();
+}
+
+/**
+ * @brief Drop all images
+ * The hit and miss counters are kept.
+ */
+void MatCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+/**
+ * @brief Change the memory budget, dropping images if it shrinks
+ * @param budgetBytes The most pixel memory the cached images may take
+ */
+void MatCache::setBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = budgetBytes;
+    evict();
+}
+
+size_t MatCache::getBudget() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget;
+}
+
+size_t MatCache::getBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+size_t MatCache::getEntries() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+/**
+ * @brief Drops least recently used images until the cache fits its budget, the lock must be held
+ */
+void MatCache::evict() {
+    while (bytes > budget && !entries.empty()) {
+        bytes -= entries.back().bytes;
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+namespace {
+
+const uint64_t blake2bIv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+const uint8_t blake2bSigma[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+inline uint64_t rotr64(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+inline uint64_t load64(const unsigned char *bytes) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+/**
+ * @brief Mixes one 128 byte block into the BLAKE2b state
+ * @param h the state
+ * @param block the block
+ * @param counter the number of bytes hashed so far, this block included
+ * @param last true for the final block
+ */
+void blake2bCompress(uint64_t h[8], const unsigned char *block, uint64_t counter, bool last) {
+    uint64_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = load64(block + 8 * i);
+    }
+    uint64_t v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = blake2bIv[i];
+    }
+    // the counter is 128 bits, the high word stays 0 below 2^64 bytes
+    v[12] ^= counter;
+    if (last) {
+        v[14] = ~v[14];
+    }
+
+    auto mix = [&](int a, int b, int c, int d, uint64_t x, uint64_t y) {
+        v[a] = v[a] + v[b] + x;
+        v[d] = rotr64(v[d] ^ v[a], 32);
+        v[c] = v[c] + v[d];
+        v[b] = rotr64(v[b] ^ v[c], 24);
+        v[a] = v[a] + v[b] + y;
+        v[d] = rotr64(v[d] ^ v[a], 16);
+        v[c] = v[c] + v[d];
+        v[b] = rotr64(v[b] ^ v[c], 63);
+    };
+    for (const uint8_t *s : blake2bSigma) {
+        mix(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        mix(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        mix(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        mix(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        mix(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        mix(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        mix(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        mix(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++) {
+        h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+} // namespace
+
+/**
+ * @brief Hash the bytes of an uploaded file
+ * BLAKE2b with a 16 byte digest. Cached images are shared between clients, so a file
+ * that is made to collide with another one must not get its images; a cryptographic
+ * hash rules that out, and still runs well below the cost of decoding the file.
+ * @param data The bytes
+ * @param size The number of bytes
+ * @return The hash
+ */
+ContentHash MatCache::hashBytes(const void *data, size_t size) {
+    constexpr size_t blockSize = 128;
+    constexpr uint64_t digestSize = sizeof(ContentHash);
+    const auto *bytes = static_cast<const unsigned char *>(data);
+
+    uint64_t h[8];
+    std::memcpy(h, blake2bIv, sizeof(h));
+    // parameter block: digest length, no key, fanout 1, depth 1
+    h[0] ^= 0x01010000ULL ^ digestSize;
+
+    size_t offset = 0;
+    while (size - offset > blockSize) {
+        blake2bCompress(h, bytes + offset, offset + blockSize, false);
+        offset += blockSize;
+    }
+    unsigned char last[blockSize] = {};
+    if (size > offset) {
+        std::memcpy(last, bytes + offset, size - offset);
+    }
+    blake2bCompress(h, last, size, true);
+
+    // the digest is the first 16 bytes of the state in little endian, which are h[0] and h[1]
+    return {h[0], h[1]};
+}
+
+size_t MatCache::KeyHash::operator()(const MatCacheKey &key) const {
+    uint64_t hash = key.content[0] ^ key.content[1];
+    hash = (hash ^ static_cast<uint32_t>(key.stage)) * fnvPrime;
+    for (int param : key.params) {
+        hash = (hash ^ static_cast<uint32_t>(param)) * fnvPrime;
+    }
+    return static_cast<size_t>(hash ^ (hash >> 32));
+}
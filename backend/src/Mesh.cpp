@@ -1,6 +1,34 @@
 #include "Mesh.hpp"
 #include <cmath>
-#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include "../header/Logger.hpp"
+
+static_assert(sizeof(float) == 4, "Binary STL and PLY store 32 bit floats");
+
+/**
+ * @brief Writes a 32 bit value little endian, whatever the byte order of the host
+ * @param ptr where to write, moved past the value
+ * @param value the value
+ */
+static void putLittle32(char *&ptr, uint32_t value) {
+    ptr[0] = static_cast<char>(value & 0xff);
+    ptr[1] = static_cast<char>((value >> 8) & 0xff);
+    ptr[2] = static_cast<char>((value >> 16) & 0xff);
+    ptr[3] = static_cast<char>(value >> 24);
+    ptr += 4;
+}
+
+/**
+ * @brief Writes a float little endian, as its 32 bit pattern
+ * @param ptr where to write, moved past the value
+ * @param value the value
+ */
+static void putLittleFloat(char *&ptr, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    putLittle32(ptr, bits);
+}
 
 /**
  * The constructor of the mesh class
@@ -32,6 +60,14 @@ void Mesh::addFace(int v1, int v2, int v3) {
     faces.emplace_back(v1, v2, v3);
 }
 
+/**
+ * @brief Add several faces to mesh
+ * @param newFaces the faces to add, in order
+ */
+void Mesh::addFaces(const std::vector<Face>& newFaces) {
+    faces.insert(faces.end(), newFaces.begin(), newFaces.end());
+}
+
 /**
  * @brief Clears faces and verticies
 */
@@ -43,7 +79,7 @@ void Mesh::clear() {
 /**
  * @brief Computes the normals of the face based on vertex coordinates
 */
-Vertex Mesh::computeNormal(const Face& f) {
+Vertex Mesh::computeNormal(const Face& f) const {
     const Vertex& a = vertices[f.v1];
     const Vertex& b = vertices[f.v2];
     const Vertex& c = vertices[f.v3];
@@ -74,7 +110,7 @@ Vertex Mesh::computeNormal(const Face& f) {
 bool Mesh::exportSTL(const std::string& filename) {
     std::ofstream file(filename);
     if (!file.is_open()) {
-        std::cerr << "Cannot open file: " << filename << "\n";
+        LOG_ERROR("Cannot open file: ", filename);
         return false;
     }
 
@@ -103,7 +139,7 @@ bool Mesh::exportSTL(const std::string& filename) {
  * @brief returns a string representation of the mesh
  * @return the string representation of the mesh
  */
-std::string Mesh::toString() {
+std::string Mesh::toString() const {
     std::ostringstream ss;
     ss << "solid mesh\n";
 
@@ -124,3 +160,137 @@ std::string Mesh::toString() {
     ss << "endsolid mesh\n";
     return ss.str();
 }
+
+/**
+ * @brief returns the mesh as binary STL
+ * The output is allocated once with its final size: an 80 byte header,
+ * the facet count and 50 bytes per facet. Values are written little endian.
+ * @return the bytes of the binary STL
+ */
+std::string Mesh::toBinarySTL() const {
+    constexpr size_t headerSize = 80;
+    constexpr size_t facetSize = 50;
+
+    std::string out(headerSize + sizeof(uint32_t) + faces.size() * facetSize, '\0');
+    char* ptr = &out[0];
+
+    const char header[] = "binary stl mesh";
+    std::memcpy(ptr, header, sizeof(header) - 1);
+    ptr += headerSize;
+
+    putLittle32(ptr, static_cast<uint32_t>(faces.size()));
+
+    for (const auto& f : faces) {
+        const Vertex normal = computeNormal(f);
+        const Vertex& v1 = vertices[f.v1];
+        const Vertex& v2 = vertices[f.v2];
+        const Vertex& v3 = vertices[f.v3];
+        const float values[12] = {
+            normal.x, normal.y, normal.z,
+            v1.x, v1.y, v1.z,
+            v2.x, v2.y, v2.z,
+            v3.x, v3.y, v3.z
+        };
+        for (float value : values) {
+            putLittleFloat(ptr, value);
+        }
+        // attribute byte count stays 0
+        ptr += sizeof(uint16_t);
+    }
+
+    return out;
+}
+
+/**
+ * @brief returns the mesh as binary PLY
+ * Like toBinarySTL the output is allocated once with its final size: the text header,
+ * 12 bytes per vertex and 13 bytes per face, a count byte and three 32 bit indices.
+ * Values are written little endian.
+ * @return the bytes of the binary PLY
+ */
+std::string Mesh::toBinaryPLY() const {
+    const std::string header =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex " + std::to_string(vertices.size()) + "\n"
+        "property float x\n"
+        "property float y\n"
+        "property float z\n"
+        "element face " + std::to_string(faces.size()) + "\n"
+        "property list uchar int vertex_indices\n"
+        "end_header\n";
+    constexpr size_t vertexSize = 3 * sizeof(float);
+    constexpr size_t faceSize = sizeof(uint8_t) + 3 * sizeof(int32_t);
+
+    std::string out(header.size() + vertices.size() * vertexSize + faces.size() * faceSize, '\0');
+    char* ptr = &out[0];
+    std::memcpy(ptr, header.data(), header.size());
+    ptr += header.size();
+
+    for (const auto& v : vertices) {
+        putLittleFloat(ptr, v.x);
+        putLittleFloat(ptr, v.y);
+        putLittleFloat(ptr, v.z);
+    }
+    for (const auto& f : faces) {
+        *ptr++ = 3;
+        putLittle32(ptr, static_cast<uint32_t>(f.v1));
+        putLittle32(ptr, static_cast<uint32_t>(f.v2));
+        putLittle32(ptr, static_cast<uint32_t>(f.v3));
+    }
+
+    return out;
+}
+
+/**
+ * @brief returns the mesh as a Wavefront OBJ
+ * @return the OBJ text, with 1-based vertex indices
+ */
+std::string Mesh::toOBJ() const {
+    std::ostringstream ss;
+    ss << "o mesh\n";
+    for (const auto& v : vertices) {
+        ss << "v " << v.x << " " << v.y << " " << v.z << "\n";
+    }
+    for (const auto& f : faces) {
+        ss << "f " << f.v1 + 1 << " " << f.v2 + 1 << " " << f.v3 + 1 << "\n";
+    }
+    return ss.str();
+}
+
+/**
+ * @brief returns the mesh element of a 3MF object
+ * The element is only a part of a 3MF model, make3MFPackage puts it in an object.
+ * @return the mesh element, empty if the mesh has no faces since a 3MF object needs at least one triangle
+ */
+std::string Mesh::to3MFMesh() const {
+    if (faces.empty()) return "";
+    std::ostringstream ss;
+    ss << "<mesh>\n<vertices>\n";
+    for (const auto& v : vertices) {
+        ss << "<vertex x=\"" << v.x << "\" y=\"" << v.y << "\" z=\"" << v.z << "\"/>\n";
+    }
+    ss << "</vertices>\n<triangles>\n";
+    for (const auto& f : faces) {
+        ss << "<triangle v1=\"" << f.v1 << "\" v2=\"" << f.v2 << "\" v3=\"" << f.v3 << "\"/>\n";
+    }
+    ss << "</triangles>\n</mesh>\n";
+    return ss.str();
+}
+
+/**
+ * @brief Exports the mesh as a binary stl file
+ * @param filename the name of the exported file
+ * @return true if saved succesfully, false otherwise
+*/
+bool Mesh::exportBinarySTL(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        LOG_ERROR("Cannot open file: ", filename);
+        return false;
+    }
+
+    const std::string data = toBinarySTL();
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    return file.good();
+}
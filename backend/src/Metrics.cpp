@@ -0,0 +1,122 @@
+#include "../header/Metrics.hpp"
+#include <algorithm>
+#include <sstream>
+
+/**
+ * @brief Count an observation
+ * @param seconds The observed duration
+ */
+void Histogram::observe(double seconds) {
+    const size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), seconds) - bounds.begin();
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumNanos.fetch_add(static_cast<uint64_t>(std::max(seconds, 0.0) * 1e9), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Read the histogram
+ * The counters are read one by one, so an observation that happens meanwhile may
+ * be in the buckets but not yet in the sum; fine for monitoring.
+ * @return The bucket counts (not cumulative), total count and sum in seconds
+ */
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snapshot{};
+    for (size_t i = 0; i < buckets.size(); i++) {
+        snapshot.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.buckets[i];
+    }
+    snapshot.sum = sumNanos.load(std::memory_order_relaxed) / 1e9;
+    return snapshot;
+}
+
+/**
+ * @brief Get the counters of an endpoint, made on first use
+ * The returned counters stay valid for the lifetime of the metrics.
+ * @param name The name of the endpoint
+ */
+RequestMetrics &Metrics::endpoint(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &entry = endpoints[name];
+    if (!entry) {
+        entry = std::make_unique<RequestMetrics>();
+    }
+    return *entry;
+}
+
+const char *Metrics::stageName(Stage stage) {
+    switch (stage) {
+        case Stage::Base64Decode: return "base64_decode";
+        case Stage::ImageDecode: return "image_decode";
+        case Stage::Blur: return "blur";
+        case Stage::Downscale: return "downscale";
+        case Stage::Map: return "map";
+        case Stage::Islands: return "islands";
+        case Stage::PngEncode: return "png_encode";
+        case Stage::Label: return "label";
+        case Stage::March: return "march";
+        case Stage::Decimate: return "decimate";
+        case Stage::Serialize: return "serialize";
+        case Stage::ResponseEncode: return "response_encode";
+        case Stage::Count: break;
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Write the lines of one histogram
+ * @param out The text to write to
+ * @param name The metric name
+ * @param labels The labels, like stage="blur"
+ * @param histogram The histogram
+ */
+static void renderHistogram(std::ostringstream &out, const std::string &name, const std::string &labels,
+                            const Histogram &histogram) {
+    const Histogram::Snapshot snapshot = histogram.snapshot();
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < Histogram::bounds.size(); i++) {
+        cumulative += snapshot.buckets[i];
+        out << name << "_bucket{" << labels << ",le=\"" << Histogram::bounds[i] << "\"} " << cumulative << "\n";
+    }
+    out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << snapshot.count << "\n";
+    out << name << "_sum{" << labels << "} " << snapshot.sum << "\n";
+    out << name << "_count{" << labels << "} " << snapshot.count << "\n";
+}
+
+/**
+ * @brief Write all metrics in the Prometheus text format
+ */
+std::string Metrics::render() const {
+    std::ostringstream out;
+
+    out << "# HELP colormap_stage_seconds Time spent in each processing stage.\n";
+    out << "# TYPE colormap_stage_seconds histogram\n";
+    for (size_t i = 0; i < stages.size(); i++) {
+        const std::string labels = std::string("stage=\"") + stageName(static_cast<Stage>(i)) + "\"";
+        renderHistogram(out, "colormap_stage_seconds", labels, stages[i]);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto counter = [&](const char *name, const char *help, std::atomic<uint64_t> RequestMetrics::*field) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " counter\n";
+        for (const auto &[endpoint, requestMetrics] : endpoints) {
+            out << name << "{endpoint=\"" << endpoint << "\"} "
+                << (requestMetrics.get()->*field).load(std::memory_order_relaxed) << "\n";
+        }
+    };
+    counter("colormap_requests_total", "Requests per endpoint.", &RequestMetrics::requests);
+    counter("colormap_request_errors_total", "Requests answered with a status of 400 or more.", &RequestMetrics::errors);
+    counter("colormap_request_bytes_total", "Bytes received in request bodies.", &RequestMetrics::bytesIn);
+    counter("colormap_response_bytes_total", "Bytes sent in response bodies.", &RequestMetrics::bytesOut);
+
+    out << "# HELP colormap_request_seconds Time to answer a request, including the wait for a worker.\n";
+    out << "# TYPE colormap_request_seconds histogram\n";
+    for (const auto &[endpoint, requestMetrics] : endpoints) {
+        renderHistogram(out, "colormap_request_seconds", "endpoint=\"" + endpoint + "\"", requestMetrics->latency);
+    }
+    return out.str();
+}
+
+Metrics &metrics() {
+    static Metrics instance;
+    return instance;
+}
@@ -0,0 +1,118 @@
+#include "../header/Multipart.hpp"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+/**
+ * @brief Compares two strings ignoring ascii case
+ */
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+    });
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+/**
+ * @brief Get a parameter of a header value, like the name in form-data; name="image"
+ * @param value The header value
+ * @param key The parameter name
+ * @return The parameter value without quotes, empty if it is missing
+ */
+static std::string getHeaderParameter(std::string_view value, std::string_view key) {
+    size_t pos = value.find(';');
+    while (pos != std::string_view::npos) {
+        const size_t next = value.find(';', pos + 1);
+        std::string_view param = trim(value.substr(pos + 1, next == std::string_view::npos ? std::string_view::npos : next - pos - 1));
+        const size_t eq = param.find('=');
+        if (eq != std::string_view::npos && equalsIgnoreCase(trim(param.substr(0, eq)), key)) {
+            std::string_view result = trim(param.substr(eq + 1));
+            if (result.size() >= 2 && result.front() == '"' && result.back() == '"') {
+                result = result.substr(1, result.size() - 2);
+            }
+            return std::string(result);
+        }
+        pos = next;
+    }
+    return "";
+}
+
+std::string getMultipartBoundary(const std::string &contentType) {
+    const std::string_view type = trim(std::string_view(contentType).substr(0, contentType.find(';')));
+    if (!equalsIgnoreCase(type, "multipart/form-data")) {
+        return "";
+    }
+    return getHeaderParameter(contentType, "boundary");
+}
+
+std::vector<MultipartPart> parseMultipart(std::string_view body, const std::string &boundary) {
+    if (boundary.empty()) {
+        throw std::invalid_argument("Multipart body without boundary");
+    }
+    const std::string delimiter = "--" + boundary;
+    const std::string partEnd = "\r\n" + delimiter;
+
+    size_t pos = body.find(delimiter);
+    if (pos == std::string_view::npos) {
+        throw std::invalid_argument("Multipart boundary not found");
+    }
+    pos += delimiter.size();
+
+    std::vector<MultipartPart> parts;
+    while (true) {
+        if (body.substr(pos, 2) == "--") {
+            return parts;
+        }
+        if (body.substr(pos, 2) != "\r\n") {
+            throw std::invalid_argument("Malformed multipart boundary");
+        }
+        pos += 2;
+
+        const size_t headersEnd = body.find("\r\n\r\n", pos);
+        if (headersEnd == std::string_view::npos) {
+            throw std::invalid_argument("Malformed multipart headers");
+        }
+
+        MultipartPart part;
+        std::string_view headers = body.substr(pos, headersEnd - pos);
+        while (!headers.empty()) {
+            const size_t lineEnd = headers.find("\r\n");
+            const std::string_view line = headers.substr(0, lineEnd);
+            const size_t colon = line.find(':');
+            if (colon != std::string_view::npos) {
+                const std::string_view key = trim(line.substr(0, colon));
+                const std::string_view value = trim(line.substr(colon + 1));
+                if (equalsIgnoreCase(key, "Content-Disposition")) {
+                    part.name = getHeaderParameter(value, "name");
+                    part.filename = getHeaderParameter(value, "filename");
+                } else if (equalsIgnoreCase(key, "Content-Type")) {
+                    part.contentType = std::string(value);
+                }
+            }
+            headers = lineEnd == std::string_view::npos ? std::string_view() : headers.substr(lineEnd + 2);
+        }
+
+        const size_t dataStart = headersEnd + 4;
+        const size_t dataEnd = body.find(partEnd, dataStart);
+        if (dataEnd == std::string_view::npos) {
+            throw std::invalid_argument("Multipart part is not terminated");
+        }
+        part.data = body.substr(dataStart, dataEnd - dataStart);
+        parts.push_back(std::move(part));
+        pos = dataEnd + partEnd.size();
+    }
+}
+
+const MultipartPart *findMultipartPart(const std::vector<MultipartPart> &parts, const std::string &name) {
+    for (const auto &part : parts) {
+        if (part.name == name) {
+            return &part;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,199 @@
+#include "../header/PaletteKernel.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PALETTE_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(PackedColor) == sizeof(int32_t), "PackedColor is loaded as 32 bit lanes");
+
+/**
+ * @brief Constructor of the kernel
+ * Splits the palette into one array per channel, ranks the colors by hex value
+ * for tie-breaking, and picks the widest instruction set the cpu supports.
+ * @param palette The palette colors
+ * @throws invalid_argument If the palette is empty or has more than maxColors colors
+ */
+PaletteKernel::PaletteKernel(const std::vector<PackedColor>& palette) {
+    if (palette.empty() || palette.size() > maxColors) {
+        throw std::invalid_argument("Palette kernel needs between 1 and 255 colors");
+    }
+
+    std::vector<int> order(palette.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return palette[a].rgb() < palette[b].rgb();
+    });
+    ranks.resize(palette.size());
+    rankToIndex = order;
+    for (int rank = 0; rank < order.size(); rank++) {
+        ranks[order[rank]] = rank;
+    }
+
+    for (const auto &color : palette) {
+        reds.push_back(color.red());
+        greens.push_back(color.green());
+        blues.push_back(color.blue());
+    }
+
+    kernel = scoreScalar;
+    instructionSet = "scalar";
+#ifdef PALETTE_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel = scoreAvx512;
+        instructionSet = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernel = scoreAvx2;
+        instructionSet = "avx2";
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        kernel = scoreSse41;
+        instructionSet = "sse4.1";
+    }
+#endif
+}
+
+/**
+ * @brief Find the closest palette color for a block of pixels
+ * @param pixels The pixels to compare, alpha is ignored
+ * @param indices Output, the palette index of the closest color for every pixel
+ * @param count The number of pixels
+ */
+void PaletteKernel::findClosest(const PackedColor *pixels, int *indices, size_t count) const {
+    constexpr size_t blockSize = 256;
+    int32_t scores[blockSize];
+
+    for (size_t start = 0; start < count; start += blockSize) {
+        const size_t n = std::min(blockSize, count - start);
+        kernel(*this, pixels + start, scores, n);
+        for (size_t i = 0; i < n; i++) {
+            indices[start + i] = rankToIndex[scores[i] & 0xFF];
+        }
+    }
+}
+
+/**
+ * @brief Scores pixels one at a time
+ * Used when no vector instructions are available and for the tail of a block.
+ */
+void PaletteKernel::scoreScalar(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count) {
+    const size_t colorCount = kernel.reds.size();
+    for (size_t i = 0; i < count; i++) {
+        const int32_t r = pixels[i].red();
+        const int32_t g = pixels[i].green();
+        const int32_t b = pixels[i].blue();
+        int32_t best = INT32_MAX;
+        for (size_t k = 0; k < colorCount; k++) {
+            const int32_t dr = r - kernel.reds[k];
+            const int32_t dg = g - kernel.greens[k];
+            const int32_t db = b - kernel.blues[k];
+            const int32_t distance = static_cast<int32_t>(std::sqrt(static_cast<float>(dr * dr + dg * dg + db * db)));
+            best = std::min(best, (distance << 8) | kernel.ranks[k]);
+        }
+        scores[i] = best;
+    }
+}
+
+#ifdef PALETTE_KERNEL_X86
+
+/**
+ * @brief Scores four pixels at a time with SSE4.1
+ */
+__attribute__((target("sse4.1")))
+void PaletteKernel::scoreSse41(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count) {
+    const size_t colorCount = kernel.reds.size();
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i));
+        const __m128i r = _mm_and_si128(_mm_srli_epi32(packed, 16), mask);
+        const __m128i g = _mm_and_si128(_mm_srli_epi32(packed, 8), mask);
+        const __m128i b = _mm_and_si128(packed, mask);
+        __m128i best = _mm_set1_epi32(INT32_MAX);
+        for (size_t k = 0; k < colorCount; k++) {
+            const __m128i dr = _mm_sub_epi32(r, _mm_set1_epi32(kernel.reds[k]));
+            const __m128i dg = _mm_sub_epi32(g, _mm_set1_epi32(kernel.greens[k]));
+            const __m128i db = _mm_sub_epi32(b, _mm_set1_epi32(kernel.blues[k]));
+            const __m128i squared = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db));
+            const __m128i distance = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(squared)));
+            best = _mm_min_epi32(best, _mm_or_si128(_mm_slli_epi32(distance, 8), _mm_set1_epi32(kernel.ranks[k])));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(scores + i), best);
+    }
+    scoreScalar(kernel, pixels + i, scores + i, count - i);
+}
+
+/**
+ * @brief Scores eight pixels at a time with AVX2
+ */
+__attribute__((target("avx2")))
+void PaletteKernel::scoreAvx2(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count) {
+    const size_t colorCount = kernel.reds.size();
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels + i));
+        const __m256i r = _mm256_and_si256(_mm256_srli_epi32(packed, 16), mask);
+        const __m256i g = _mm256_and_si256(_mm256_srli_epi32(packed, 8), mask);
+        const __m256i b = _mm256_and_si256(packed, mask);
+        __m256i best = _mm256_set1_epi32(INT32_MAX);
+        for (size_t k = 0; k < colorCount; k++) {
+            const __m256i dr = _mm256_sub_epi32(r, _mm256_set1_epi32(kernel.reds[k]));
+            const __m256i dg = _mm256_sub_epi32(g, _mm256_set1_epi32(kernel.greens[k]));
+            const __m256i db = _mm256_sub_epi32(b, _mm256_set1_epi32(kernel.blues[k]));
+            const __m256i squared = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)), _mm256_mullo_epi32(db, db));
+            const __m256i distance = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(squared)));
+            best = _mm256_min_epi32(best, _mm256_or_si256(_mm256_slli_epi32(distance, 8), _mm256_set1_epi32(kernel.ranks[k])));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(scores + i), best);
+    }
+    scoreScalar(kernel, pixels + i, scores + i, count - i);
+}
+
+/**
+ * @brief Scores sixteen pixels at a time with AVX-512
+ */
+__attribute__((target("avx512f")))
+void PaletteKernel::scoreAvx512(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count) {
+    const size_t colorCount = kernel.reds.size();
+    const __m512i mask = _mm512_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i packed = _mm512_loadu_si512(pixels + i);
+        const __m512i r = _mm512_and_si512(_mm512_srli_epi32(packed, 16), mask);
+        const __m512i g = _mm512_and_si512(_mm512_srli_epi32(packed, 8), mask);
+        const __m512i b = _mm512_and_si512(packed, mask);
+        __m512i best = _mm512_set1_epi32(INT32_MAX);
+        for (size_t k = 0; k < colorCount; k++) {
+            const __m512i dr = _mm512_sub_epi32(r, _mm512_set1_epi32(kernel.reds[k]));
+            const __m512i dg = _mm512_sub_epi32(g, _mm512_set1_epi32(kernel.greens[k]));
+            const __m512i db = _mm512_sub_epi32(b, _mm512_set1_epi32(kernel.blues[k]));
+            const __m512i squared = _mm512_add_epi32(_mm512_add_epi32(_mm512_mullo_epi32(dr, dr), _mm512_mullo_epi32(dg, dg)), _mm512_mullo_epi32(db, db));
+            const __m512i distance = _mm512_cvttps_epi32(_mm512_sqrt_ps(_mm512_cvtepi32_ps(squared)));
+            best = _mm512_min_epi32(best, _mm512_or_si512(_mm512_slli_epi32(distance, 8), _mm512_set1_epi32(kernel.ranks[k])));
+        }
+        _mm512_storeu_si512(scores + i, best);
+    }
+    scoreScalar(kernel, pixels + i, scores + i, count - i);
+}
+
+#else
+
+void PaletteKernel::scoreSse41(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count) {
+    scoreScalar(kernel, pixels, scores, count);
+}
+
+void PaletteKernel::scoreAvx2(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count) {
+    scoreScalar(kernel, pixels, scores, count);
+}
+
+void PaletteKernel::scoreAvx512(const PaletteKernel &kernel, const PackedColor *pixels, int32_t *scores, size_t count) {
+    scoreScalar(kernel, pixels, scores, count);
+}
+
+#endif
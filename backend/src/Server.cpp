@@ -1,99 +1,254 @@
 #include <string>
 #include <vector>
+#include <functional>
+#include <optional>
+#include <future>
+#include <thread>
+#include <algorithm>
 #include "../header/Server.hpp"
-#include <iostream>
+#include "../header/Base64.hpp"
+#include "../header/Multipart.hpp"
+#include "../header/MatCache.hpp"
+#include "../header/Metrics.hpp"
+#include "../header/Logger.hpp"
 #include <nlohmann/json.hpp>
 #include <opencv2/opencv.hpp>
 #include "../header/Color.hpp"
 #include "../header/ColorMap.hpp"
 #include "../header/ImageHandler.hpp"
 #include "../header/Mesh.hpp"
+#include "../header/ContourMesh.hpp"
 #include "../header/MarchingSquare.hpp"
+#include "../header/ThreeMF.hpp"
+#include "../header/Islands.hpp"
+#include "../header/ImagePipeline.hpp"
 
 
-Server::Server(int port) : port(port), running(false) {
-    std::cout << "Server initialized on port " << port << std::endl;
+/**
+ * @brief Get the thread budget of a job
+ * @param options the server settings
+ * @return the threads per job from the settings, or an even share of the cores if that is 0
+ */
+static int threadsPerJob(const ServerOptions &options) {
+    if (options.threadsPerJob > 0) {
+        return options.threadsPerJob;
+    }
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    return std::max(1, cores / std::max(1, options.workers));
+}
+
+/**
+ * @brief Sets the level of the logger and of crow
+ * Crow logs every request at its info level on the calling thread, so it only gets to
+ * log at info when the logger is at debug.
+ * @param level the new level
+ */
+static void setLogLevel(LogLevel level) {
+    logger().setLevel(level);
+    switch (level) {
+        case LogLevel::Debug: crow::logger::setLogLevel(crow::LogLevel::Info); break;
+        case LogLevel::Info:
+        case LogLevel::Warning: crow::logger::setLogLevel(crow::LogLevel::Warning); break;
+        case LogLevel::Error: crow::logger::setLogLevel(crow::LogLevel::Error); break;
+        case LogLevel::Off: crow::logger::setLogLevel(crow::LogLevel::Critical); break;
+    }
 }
 
+Server::Server(int port, const ServerOptions &options)
+    : port(port), running(false), logLevelControl(options.logLevelControl), imageCache(options.cacheBytes), sessions(options.sessionBytes, options.sessionTtl),
+      asyncJobs([this](std::function<void()> task) { return scheduler.trySubmit(std::move(task)); }, options.jobTtl,
+                options.jobBytes),
+      scheduler(options.workers, options.queueCapacity, threadsPerJob(options)) {
+    // all jobs together may use as many OpenCV threads as their budgets add up to
+    cv::setNumThreads(scheduler.getWorkers() * scheduler.getThreadsPerJob());
+    PaletteLookup::setCacheSize(options.paletteCacheSize);
+    setLogLevel(options.logLevel);
+    LOG_INFO("Server initialized on port ", port, " with ", scheduler.getWorkers(), " workers of ",
+             scheduler.getThreadsPerJob(), " threads");
+}
 
-const std::string base64_chars =
-             "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-             "abcdefghijklmnopqrstuvwxyz"
-             "0123456789+/";
+/**
+ * @brief Runs a request on the job scheduler and waits for its response
+ * Keeps heavy work off the http threads and limits how much of it runs at once.
+ * @param job The request handler
+ * @return The response of the handler, or 503 with Retry-After if the queue is full
+ */
+crow::response Server::runJob(const std::function<crow::response()> &job) {
+    std::packaged_task<crow::response()> task(job);
+    std::future<crow::response> result = task.get_future();
+    if (!scheduler.trySubmit([&task]() { task(); })) {
+        return busyResponse();
+    }
+    return result.get();
+}
 
 /**
- * @brief Decodes a Base64 encoded string
- * Decodes a Base64 encoded string into a vector of unsigned characters. Used for decoding image data in requests.
- * @param in The Base64 encoded string to decode.
- * @return A vector of unsigned characters representing the decoded data.
+ * @brief The response for a request that the job scheduler has no room for
+ * @return 503 with a Retry-After header
  */
-static inline std::vector<uchar> base64_decode(const std::string &in) {
-    std::vector<int> T(256, -1);
-    for (int i = 0; i < 64; i++) T[base64_chars[i]] = i;
+crow::response Server::busyResponse() const {
+    crow::response res(503, "Server is busy, try again later");
+    res.set_header("Retry-After", std::to_string(scheduler.getRetryAfter().count()));
+    return res;
+}
 
-    std::vector<uchar> out;
-    int val = 0, valb = -8;
 
-    for (unsigned char c : in) {
-        if (c == '=') break;
-        if (T[c] == -1) continue;
+/**
+ * @brief Decodes an uploaded image file
+ * The file is hashed first, and a file that was decoded before is taken from the cache.
+ * @param cache The image cache
+ * @param bytes The image file
+ * @return The decoded image, empty if it could not be decoded
+ */
+static UploadedImage decodeImageBytes(MatCache &cache, std::string_view bytes) {
+    UploadedImage upload;
+    if (bytes.empty()) {
+        return upload;
+    }
+    upload.content = MatCache::hashBytes(bytes.data(), bytes.size());
+    const MatCacheKey key{upload.content, static_cast<int>(PipelineStage::Decode), {}};
+    if (cache.get(key, upload.image)) {
+        return upload;
+    }
 
-        val = (val << 6) + T[c];
-        valb += 6;
-        if (valb >= 0) {
-            out.push_back(static_cast<uchar>((val >> valb) & 0xFF));
-            valb -= 8;
-        }
+    // imdecode only reads the buffer, the cast is needed because Mat has no const constructor
+    const cv::Mat buffer(1, static_cast<int>(bytes.size()), CV_8U, const_cast<char*>(bytes.data()));
+    {
+        ScopedTimer timer(Stage::ImageDecode);
+        upload.image = cv::imdecode(buffer, cv::IMREAD_UNCHANGED);
+    }
+    if (!upload.image.empty()) {
+        cache.put(key, upload.image);
     }
-    return out;
+    return upload;
 }
 
 /**
- * @brief encodes bytes to a base64 string
- * @param bytes_to_encode the bytes that are encoded
- * @param in_len the length
- * @return the base64 string
+ * @brief Decodes the base64 image field of a request
+ * The field is decoded in place inside the parsed json, so the image bytes are never copied.
+ * @param cache The image cache
+ * @param parsed The parsed request, its image field is left holding decoded bytes
+ * @return The decoded image, empty if it could not be decoded
  */
-std::string base64_encode(const unsigned char* bytes_to_encode, unsigned int in_len) {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for (i = 0; i < 4; i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
+static UploadedImage decodeImageField(MatCache &cache, nlohmann::json &parsed) {
+    std::string &field = parsed["image"].get_ref<std::string&>();
+    size_t size;
+    {
+        ScopedTimer timer(Stage::Base64Decode);
+        size = base64_decode_inplace(&field[0], field.size());
     }
+    return decodeImageBytes(cache, std::string_view(field.data(), size));
+}
 
-    if (i) {
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+/**
+ * @brief Looks up an image that was uploaded before
+ * @param sessions the uploaded images
+ * @param handle the handle of the image
+ * @param upload output, the image
+ * @return an error response if the handle is unknown or expired, otherwise nothing
+ */
+static std::optional<crow::response> findStoredImage(SessionStore &sessions, const std::string &handle,
+                                                     UploadedImage &upload) {
+    std::optional<UploadedImage> stored = sessions.get(handle);
+    if (!stored) {
+        return crow::response(404, "Unknown or expired image handle");
+    }
+    upload = std::move(*stored);
+    return std::nullopt;
+}
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+/**
+ * @brief Get the image of a json request
+ * The request holds either the base64 file in its image field, or the handle of an uploaded image.
+ * @param cache the image cache
+ * @param sessions the uploaded images
+ * @param parsed the parsed request
+ * @param upload output, the image
+ * @return an error response if there is no valid image, otherwise nothing
+ */
+static std::optional<crow::response> readRequestImage(MatCache &cache, SessionStore &sessions, nlohmann::json &parsed,
+                                                      UploadedImage &upload) {
+    if (parsed.contains("handle")) {
+        return findStoredImage(sessions, parsed["handle"].get<std::string>(), upload);
+    }
+    upload = decodeImageField(cache, parsed);
+    if (upload.image.empty()) {
+        return crow::response(400, "Invalid image");
+    }
+    return std::nullopt;
+}
 
-        for (j = 0; j < i + 1; j++)
-            ret += base64_chars[char_array_4[j]];
+/**
+ * @brief appends a model as a json object to a string
+ * The model is base64 encoded straight into the string, without building a json document.
+ * Its key is stl for both stl formats and the name of the format otherwise.
+ * @param out the string to append to
+ * @param format the format of the model
+ * @param color the color of the model
+ * @param model the model bytes
+ */
+static void appendModelJson(std::string &out, const std::string &format, const std::string &color, const std::string &model) {
+    ScopedTimer timer(Stage::ResponseEncode);
+    out += "{\"color\":";
+    out += nlohmann::json(color).dump();
+    out += ",\"";
+    out += format == "ascii" || format == "binary" ? "stl" : format;
+    out += "\":\"";
+    base64_append(out, reinterpret_cast<const unsigned char*>(model.data()), model.size());
+    out += "\"}";
+}
 
-        while (i++ < 3)
-            ret += '=';
+/**
+ * @brief makes a response with all models in one 3MF file
+ * @param objects the color and mesh element of every model
+ * @return the 3MF file as a download
+ */
+static crow::response packageResponse(const std::vector<ThreeMFObject> &objects) {
+    std::string package;
+    {
+        ScopedTimer timer(Stage::ResponseEncode);
+        package = make3MFPackage(objects);
     }
+    crow::response res(200, std::move(package));
+    res.set_header("Content-Type", "model/3mf");
+    res.set_header("Content-Disposition", "attachment; filename=\"models.3mf\"");
+    return res;
+}
 
-    return ret;
+/**
+ * @brief lists the colors whose model stayed over the triangle budget in the X-Over-Budget header
+ * @param res the response of a 3MF file
+ * @param overBudget the colors, the header is left out if there are none
+ */
+static void setOverBudgetHeader(crow::response &res, const std::vector<std::string> &overBudget) {
+    if (overBudget.empty()) return;
+    std::string colors;
+    for (const std::string &color : overBudget) {
+        if (!colors.empty()) colors += ",";
+        colors += color;
+    }
+    res.set_header("X-Over-Budget", colors);
 }
 
+/**
+ * @brief Runs a route handler and counts the request in the metrics of its endpoint
+ * @param endpoint the metrics of the endpoint
+ * @param req the request
+ * @param handler makes the response
+ * @return the response of the handler
+ */
+template <typename Handler>
+static crow::response observeRequest(RequestMetrics &endpoint, const crow::request &req, Handler &&handler) {
+    ScopedTimer timer(endpoint.latency);
+    crow::response res = handler();
+    endpoint.requests.fetch_add(1, std::memory_order_relaxed);
+    endpoint.bytesIn.fetch_add(req.body.size(), std::memory_order_relaxed);
+    endpoint.bytesOut.fetch_add(res.body.size(), std::memory_order_relaxed);
+    if (res.code >= 400) {
+        endpoint.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    return res;
+}
 
 /**
   * @brief Starts the server
@@ -110,22 +265,146 @@ void Server::start() {
 
     CROW_ROUTE(colorMapServer, "/api/image_processing")
     .methods("POST"_method)
-    ([this](const crow::request &req) {
-        std::string requestBody = req.body;
-        std::cout << "Received image processing request: " << requestBody << std::endl;
-        return handleImageProcessingRequest(requestBody);
+    ([this, &endpoint = metrics().endpoint("image_processing")](const crow::request &req) {
+        LOG_DEBUG("Received image processing request of ", req.body.size(), " bytes");
+        return observeRequest(endpoint, req, [&]() { return runJob([&]() { return handleImageProcessingRequest(req.body); }); });
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/image_processing/raw")
+    .methods("POST"_method)
+    ([this, &endpoint = metrics().endpoint("image_processing_raw")](const crow::request &req) {
+        LOG_DEBUG("Received raw image processing request of ", req.body.size(), " bytes");
+        return observeRequest(endpoint, req, [&]() { return runJob([&]() { return handleRawImageProcessingRequest(req); }); });
+    });
+
+    // one request per message, every model is sent as its own message as soon as it is done
+    CROW_WEBSOCKET_ROUTE(colorMapServer, "/api/image_processing/stream")
+    .onopen([](crow::websocket::connection &conn) {
+        conn.userdata(new std::shared_ptr<StreamPeer>(std::make_shared<StreamPeer>(conn)));
+    })
+    // crow versions differ in whether the close code is passed
+    .onclose([](crow::websocket::connection &conn, const std::string &, auto...) {
+        auto *peer = static_cast<std::shared_ptr<StreamPeer> *>(conn.userdata());
+        if (peer == nullptr) return;
+        (*peer)->detach();
+        conn.userdata(nullptr);
+        delete peer;
+    })
+    .onmessage([this, &endpoint = metrics().endpoint("image_processing_stream")](
+                   crow::websocket::connection &conn, const std::string &data, bool) {
+        LOG_DEBUG("Received streaming image processing request of ", data.size(), " bytes");
+        std::shared_ptr<StreamPeer> peer = *static_cast<std::shared_ptr<StreamPeer> *>(conn.userdata());
+        endpoint.requests.fetch_add(1, std::memory_order_relaxed);
+        endpoint.bytesIn.fetch_add(data.size(), std::memory_order_relaxed);
+        const bool accepted = scheduler.trySubmit([this, &endpoint, peer, data]() {
+            ScopedTimer timer(endpoint.latency);
+            const size_t before = peer->bytesSent();
+            if (!handleImageProcessingStream(data, *peer)) {
+                endpoint.errors.fetch_add(1, std::memory_order_relaxed);
+            }
+            endpoint.bytesOut.fetch_add(peer->bytesSent() - before, std::memory_order_relaxed);
+        });
+        if (!accepted) {
+            endpoint.errors.fetch_add(1, std::memory_order_relaxed);
+            peer->send(nlohmann::json{{"error", "Server is busy"},
+                                      {"retryAfter", scheduler.getRetryAfter().count()}}.dump());
+        }
     });
 
     CROW_ROUTE(colorMapServer, "/api/color_map")
     .methods("POST"_method)
+    ([this, &endpoint = metrics().endpoint("color_map")](const crow::request &req) {
+        LOG_DEBUG("Received color map request of ", req.body.size(), " bytes");
+        return observeRequest(endpoint, req, [&]() { return runJob([&]() { return handleColorMapRequest(req.body); }); });
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/color_map/raw")
+    .methods("POST"_method)
+    ([this, &endpoint = metrics().endpoint("color_map_raw")](const crow::request &req) {
+        LOG_DEBUG("Received raw color map request of ", req.body.size(), " bytes");
+        return observeRequest(endpoint, req, [&]() { return runJob([&]() { return handleRawColorMapRequest(req); }); });
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/upload")
+    .methods("POST"_method)
+    ([this, &endpoint = metrics().endpoint("upload")](const crow::request &req) {
+        LOG_DEBUG("Received upload request of ", req.body.size(), " bytes");
+        return observeRequest(endpoint, req, [&]() { return runJob([&]() { return handleUploadRequest(req); }); });
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/upload/<string>")
+    .methods("DELETE"_method)
+    ([this](const std::string &handle) {
+        return crow::response(sessions.remove(handle) ? 204 : 404);
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/jobs")
+    .methods("POST"_method)
+    ([this, &endpoint = metrics().endpoint("jobs")](const crow::request &req) {
+        LOG_DEBUG("Received job submission of ", req.body.size(), " bytes");
+        return observeRequest(endpoint, req, [&]() { return handleJobSubmitRequest(req); });
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/jobs/<string>")
+    .methods("GET"_method)
+    ([this](const std::string &id) {
+        return handleJobStatusRequest(id);
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/jobs/<string>")
+    .methods("DELETE"_method)
+    ([this](const std::string &id) {
+        return crow::response(asyncJobs.remove(id) ? 204 : 404);
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/jobs/<string>/models")
+    .methods("GET"_method)
+    ([this](const std::string &id) {
+        return handleJobModelsRequest(id);
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/jobs/<string>/models/<int>")
+    .methods("GET"_method)
+    ([this](const std::string &id, int index) {
+        return handleJobModelRequest(id, index);
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/metrics")
+    ([this]() {
+        return handleMetricsRequest();
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/log_level")
+    .methods("GET"_method, "POST"_method)
     ([this](const crow::request &req) {
-        std::string requestBody = req.body;
-        std::cout << "Received color map request: " << requestBody << std::endl;
-        return handleColorMapRequest(requestBody);
+        return handleLogLevelRequest(req);
+    });
+
+    CROW_ROUTE(colorMapServer, "/api/cache")
+    ([this]() {
+        nlohmann::json stats;
+        stats["hits"] = imageCache.getHits();
+        stats["misses"] = imageCache.getMisses();
+        stats["entries"] = imageCache.getEntries();
+        stats["bytes"] = imageCache.getBytes();
+        stats["budget"] = imageCache.getBudget();
+        stats["sessions"] = sessions.getSessions();
+        stats["sessionBytes"] = sessions.getBytes();
+        stats["jobsQueued"] = scheduler.getQueued();
+        stats["jobsRunning"] = scheduler.getRunning();
+        stats["jobsRejected"] = scheduler.getRejected();
+        stats["asyncJobs"] = asyncJobs.getJobs();
+        stats["asyncJobBytes"] = asyncJobs.getBytes();
+        stats["paletteTables"] = PaletteLookup::getCachedLookups();
+        stats["paletteTableBytes"] = PaletteLookup::getCacheBytes();
+        return crow::response(200, stats.dump());
     });
 
-    colorMapServer.port(port).multithreaded().run();
-    std::cout << "Server started on port " << port << std::endl;
+    // http threads wait for their jobs, so there are enough of them for every running and
+    // queued job plus some to turn away requests when the queue is full and to answer health checks
+    const size_t httpThreads = scheduler.getWorkers() + scheduler.getQueueCapacity() + 2;
+    LOG_INFO("Server starting on port ", port);
+    colorMapServer.port(port).concurrency(std::max<size_t>(httpThreads, std::thread::hardware_concurrency())).run();
 }
 
 /**
@@ -135,113 +414,565 @@ void Server::start() {
 void Server::stop() {
     running = false;
     colorMapServer.stop();
-    std::cout << "Server stopped." << std::endl;
+    LOG_INFO("Server stopped");
+}
+
+/**
+ * @brief The options of an image processing request
+ */
+struct ImageProcessingOptions {
+    std::vector<std::string> colors;
+    std::string format = "ascii";
+    int minIslandSize = 0;
+    bool mergeFaces = false;
+    long long maxTriangles = 0;
+    std::string meshMode = "marching";
+    double contourTolerance = 0.5;
+};
+
+/**
+ * @brief The options of a color map request are the settings of its preprocessing pipeline
+ */
+using ColorMapOptions = PipelineSettings;
+
+// the smallest island that is kept when a request removes islands without giving a size
+static constexpr int defaultMinIslandSize = 16;
+
+/**
+ * @brief gets the island option of a request
+ * @param removeIslands if the request removes islands
+ * @param minIslandSize the smallest island the request keeps, if given
+ * @return the smallest island that is kept, 0 if no islands are removed
+ * @throws invalid_argument if the size is negative
+ */
+static int islandOption(bool removeIslands, std::optional<int> minIslandSize) {
+    if (minIslandSize && *minIslandSize < 0) {
+        throw std::invalid_argument("minIslandSize must not be negative");
+    }
+    return removeIslands ? minIslandSize.value_or(defaultMinIslandSize) : 0;
+}
+
+/**
+ * @brief reads the island option of a json request
+ * @param parsed the json body
+ * @return the smallest island that is kept, 0 if no islands are removed
+ */
+static int readIslandOption(const nlohmann::json &parsed) {
+    std::optional<int> minIslandSize;
+    if (parsed.contains("minIslandSize")) {
+        minIslandSize = parsed["minIslandSize"].get<int>();
+    }
+    return islandOption(parsed.value("removeIslands", false), minIslandSize);
 }
 
 /**
- * @brief processes an image and marches it with all given colors
- * Returns the generated models
+ * @brief serializes a mesh in the format of a request
+ * @param mesh the mesh to serialize
+ * @param format ascii or binary stl, ply, obj, or 3mf for the mesh element of a 3MF object
+ * @return the model bytes
+ */
+static std::string serializeMesh(const Mesh &mesh, const std::string &format) {
+    if (format == "binary") return mesh.toBinarySTL();
+    if (format == "ply") return mesh.toBinaryPLY();
+    if (format == "obj") return mesh.toOBJ();
+    if (format == "3mf") return mesh.to3MFMesh();
+    return mesh.toString();
+}
+
+/**
+ * @brief processes an image and meshes it with all given colors
+ * Every model is handed to onModel as soon as its mesh is done and
+ * dropped after that, so only one model is kept in memory at a time.
+ * The marching mode meshes every cell of the grid, the contour mode only
+ * the outlines of the regions.
  * 
- * @param colors the colors from the request
+ * @param options the colors, model format, island size, mesh mode and triangle budget from the request
  * @param image the image to process
- * @return the models generated
+ * @param onModel called with the color and the bytes of every model, in color order, the bytes may be moved from
+ * @return the colors whose model still has more triangles than the budget, as decimating
+ * stops before it would change the shape
  */
-std::vector<std::pair<std::string, std::string>> processImage(const std::vector<std::string> &colors, const cv::Mat &image) {
+std::vector<std::string> processImage(const ImageProcessingOptions &options, const cv::Mat &image,
+                  const std::function<void(const std::string &, std::string &&)> &onModel) {
+    const std::vector<std::string> &colors = options.colors;
     ImageHandler imageHandler = ImageHandler();
     ColorMap colorMap = ColorMap(colors);
-    std::string outputFolder = "/app/output/";
 
     imageHandler.setImage(image);
-    int w = image.cols;
-    int h = image.rows;
+    LabelImage labels;
+    {
+        ScopedTimer timer(Stage::Label);
+        labels = imageHandler.getLabelImage(colorMap);
+    }
+    if (options.minIslandSize > 1) {
+        ScopedTimer timer(Stage::Islands);
+        const size_t removed = removeIslands(labels, options.minIslandSize);
+        LOG_DEBUG("Removed ", removed, " islands");
+    }
+    LOG_DEBUG("Image is labeled");
+
+    std::vector<std::string> overBudget;
+    // decimates and serializes a finished mesh
+    const auto finish = [&](auto &mesher, const std::string &color) {
+        if (options.maxTriangles > 0) {
+            ScopedTimer timer(Stage::Decimate);
+            const size_t budget = static_cast<size_t>(options.maxTriangles);
+            const size_t removed = mesher.decimate({budget});
+            LOG_DEBUG("Decimated ", removed, " triangles");
+            if (mesher.getMesh().getFaces().size() > budget) {
+                overBudget.push_back(color);
+            }
+        }
+        ScopedTimer timer(Stage::Serialize);
+        return serializeMesh(mesher.getMesh(), options.format);
+    };
+
+    const std::vector<Color>& palette = colorMap.getColors();
+    for (size_t i = 0; i < palette.size(); i++) {
+        const Color& color = palette[i];
+        // a repeated color has the label of its first occurrence
+        size_t first = 0;
+        while (palette[first] != color) first++;
+        const uint8_t label = static_cast<uint8_t>(first + 1);
 
-    std::vector<std::pair<std::string, std::string>> models;
+        std::string model;
+        if (options.meshMode == "contour") {
+            ContourMesh contours(labels, label, options.contourTolerance);
+            {
+                ScopedTimer timer(Stage::March);
+                contours.traceContours();
+            }
+            model = finish(contours, colors[i]);
+        } else {
+            MarchingSquare ms(labels, label, options.mergeFaces);
+            {
+                ScopedTimer timer(Stage::March);
+                ms.marchSquares();
+            }
+            model = finish(ms, colors[i]);
+        }
+        onModel(colors[i], std::move(model));
+        LOG_DEBUG("Finished color ", color.getHex());
+    }
+    return overBudget;
+}
 
-    for (const Color& color : colorMap.getColors()) {
-        Matrix m = imageHandler.getImageAsMatrix(color);
-        std::cout << "image is now matrix" <<std::endl;
-        MarchingSquare ms(m, w+2, h+2);
-        ms.marchSquares();
+/**
+ * @brief checks the options of an image processing request
+ * @param options the options to check
+ * @return an error response if the options are invalid, otherwise nothing
+ */
+static std::optional<crow::response> validateImageProcessingOptions(const ImageProcessingOptions &options) {
+    const std::string &format = options.format;
+    if (format != "ascii" && format != "binary" && format != "ply" && format != "obj" && format != "3mf") {
+        return crow::response(400, "Invalid format, expected ascii, binary, ply, obj or 3mf");
+    }
+    if (options.maxTriangles < 0) {
+        return crow::response(400, "maxTriangles must not be negative");
+    }
+    if (options.meshMode != "marching" && options.meshMode != "contour") {
+        return crow::response(400, "Invalid meshMode, expected marching or contour");
+    }
+    if (!(options.contourTolerance >= 0)) {
+        return crow::response(400, "contourTolerance must not be negative");
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief reads the image and options of an image processing request
+ * @param cache the image cache
+ * @param sessions the uploaded images
+ * @param body the json body of the request
+ * @param upload output, the decoded image
+ * @param options output, the colors and model format
+ * @return an error response if the request is invalid, otherwise nothing
+ */
+static std::optional<crow::response> parseImageProcessingRequest(MatCache &cache, SessionStore &sessions, const std::string& body,
+                                                                 UploadedImage &upload, ImageProcessingOptions &options) {
+    using json = nlohmann::json;
+
+    auto parsed = json::parse(body);
+
+    if (auto error = readRequestImage(cache, sessions, parsed, upload)) {
+        return error;
+    }
+    options.colors = parsed.value("colors", std::vector<std::string>{});
+    options.format = parsed.value("format", "ascii");
+    options.minIslandSize = readIslandOption(parsed);
+    options.mergeFaces = parsed.value("mergeFaces", false);
+    options.maxTriangles = parsed.value("maxTriangles", 0LL);
+    options.meshMode = parsed.value("meshMode", "marching");
+    options.contourTolerance = parsed.value("contourTolerance", options.contourTolerance);
+    return validateImageProcessingOptions(options);
+}
+
+/**
+ * @brief reads a parameter of a raw upload
+ * The query string is checked first, then the header, then a text field of a multipart form.
+ * @param req the request
+ * @param parts the parts of a multipart body, empty for an octet-stream body
+ * @param name the name in the query string and the form
+ * @param header the name of the header
+ * @return the value, or nothing if the parameter is not given
+ */
+static std::optional<std::string> getRawParameter(const crow::request &req, const std::vector<MultipartPart> &parts,
+                                                  const std::string &name, const std::string &header) {
+    if (const char *value = req.url_params.get(name)) {
+        return std::string(value);
+    }
+    const std::string &value = req.get_header_value(header);
+    if (!value.empty()) {
+        return value;
+    }
+    if (const MultipartPart *part = findMultipartPart(parts, name)) {
+        return std::string(part->data);
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief splits a comma separated list of hex colors
+ * The # is optional, since it has to be escaped in a query string.
+ * @param list the list, like FF0000,#00FF00
+ * @return the colors in #RRGGBB form
+ */
+static std::vector<std::string> splitColors(const std::string &list) {
+    std::vector<std::string> colors;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string color = list.substr(start, end - start);
+        color.erase(0, color.find_first_not_of(' '));
+        color.erase(color.find_last_not_of(' ') + 1);
+        if (!color.empty()) {
+            colors.push_back(color[0] == '#' ? color : "#" + color);
+        }
+        start = end + 1;
+    }
+    return colors;
+}
+
+/**
+ * @brief decodes the image of a raw upload
+ * The body is either the image file itself (application/octet-stream or an image type),
+ * or a multipart form with the file in the image field. The image is decoded straight
+ * from the request body, without copying it. Instead of a file, the handle of an uploaded
+ * image can be given as the handle parameter.
+ * @param cache the image cache
+ * @param sessions the uploaded images
+ * @param req the request
+ * @param upload output, the decoded image
+ * @param parts output, the parts of a multipart body
+ * @return an error response if there is no valid image, otherwise nothing
+ */
+static std::optional<crow::response> decodeRawUpload(MatCache &cache, SessionStore &sessions, const crow::request &req,
+                                                     UploadedImage &upload, std::vector<MultipartPart> &parts) {
+    const std::string boundary = getMultipartBoundary(req.get_header_value("Content-Type"));
+    if (!boundary.empty()) {
+        parts = parseMultipart(req.body, boundary);
+    }
+    if (auto handle = getRawParameter(req, parts, "handle", "X-Image-Handle")) {
+        return findStoredImage(sessions, *handle, upload);
+    }
+
+    std::string_view bytes = req.body;
+    if (!boundary.empty()) {
+        const MultipartPart *part = findMultipartPart(parts, "image");
+        if (part == nullptr) {
+            return crow::response(400, "Missing image field");
+        }
+        bytes = part->data;
+    }
+    if (bytes.empty()) {
+        return crow::response(400, "Missing image");
+    }
+
+    upload = decodeImageBytes(cache, bytes);
+    if (upload.image.empty()) {
+        return crow::response(400, "Invalid image");
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief reads a flag of a raw upload
+ * @param value the parameter, if given
+ * @return true if the parameter is true or 1
+ */
+static bool isRawFlagSet(const std::optional<std::string> &value) {
+    return value && (*value == "true" || *value == "1");
+}
+
+/**
+ * @brief reads the island option of a raw upload
+ * @param req the request
+ * @param parts the parts of a multipart body, empty for an octet-stream body
+ * @return the smallest island that is kept, 0 if no islands are removed
+ */
+static int readRawIslandOption(const crow::request &req, const std::vector<MultipartPart> &parts) {
+    std::optional<int> minIslandSize;
+    if (auto size = getRawParameter(req, parts, "minIslandSize", "X-Min-Island-Size")) {
+        minIslandSize = std::stoi(*size);
+    }
+    return islandOption(isRawFlagSet(getRawParameter(req, parts, "removeIslands", "X-Remove-Islands")), minIslandSize);
+}
 
-        std::string stl = ms.getMeshString();
-        std::string encoded = base64_encode(
-            reinterpret_cast<const unsigned char*>(stl.data()),
-            stl.size()
-        );
+/**
+ * @brief reads the image and options of a raw image processing request
+ * The options are the same as in the json request: colors, format, removeIslands, minIslandSize, mergeFaces,
+ * maxTriangles, meshMode and contourTolerance.
+ * @param cache the image cache
+ * @param sessions the uploaded images
+ * @param req the request
+ * @param upload output, the decoded image
+ * @param options output, the colors and model format
+ * @return an error response if the request is invalid, otherwise nothing
+ */
+static std::optional<crow::response> parseRawImageProcessingRequest(MatCache &cache, SessionStore &sessions, const crow::request &req,
+                                                                    UploadedImage &upload, ImageProcessingOptions &options) {
+    std::vector<MultipartPart> parts;
+    if (auto error = decodeRawUpload(cache, sessions, req, upload, parts)) {
+        return error;
+    }
+    if (auto colors = getRawParameter(req, parts, "colors", "X-Colors")) {
+        options.colors = splitColors(*colors);
+    }
+    if (auto format = getRawParameter(req, parts, "format", "X-Format")) {
+        options.format = *format;
+    }
+    options.minIslandSize = readRawIslandOption(req, parts);
+    options.mergeFaces = isRawFlagSet(getRawParameter(req, parts, "mergeFaces", "X-Merge-Faces"));
+    if (auto maxTriangles = getRawParameter(req, parts, "maxTriangles", "X-Max-Triangles")) {
+        options.maxTriangles = std::stoll(*maxTriangles);
+    }
+    if (auto meshMode = getRawParameter(req, parts, "meshMode", "X-Mesh-Mode")) {
+        options.meshMode = *meshMode;
+    }
+    if (auto contourTolerance = getRawParameter(req, parts, "contourTolerance", "X-Contour-Tolerance")) {
+        options.contourTolerance = std::stod(*contourTolerance);
+    }
+    return validateImageProcessingOptions(options);
+}
 
-        models.emplace_back(color.getHex(), encoded);
-        std::cout<< "finished color " << color.getHex() << std::endl;
+/**
+ * @brief makes the models of an image processing request
+ * The colors whose model stayed over the triangle budget are listed in overBudget,
+ * or in the X-Over-Budget header of a 3MF file.
+ * @param image the decoded image
+ * @param options the colors and model format
+ * @return the response with one model per color, or one 3MF file with all of them
+ */
+static crow::response imageProcessingResponse(const cv::Mat &image, const ImageProcessingOptions &options) {
+    if (options.format == "3mf") {
+        std::vector<ThreeMFObject> objects;
+        const std::vector<std::string> overBudget = processImage(options, image, [&](const std::string &color, std::string &&mesh) {
+            objects.push_back({color, std::move(mesh)});
+        });
+        crow::response res = packageResponse(objects);
+        setOverBudgetHeader(res, overBudget);
+        return res;
     }
 
-    return models;
+    std::string response = "{\"format\":\"" + options.format + "\",\"models\":[";
+    bool first = true;
+    const std::vector<std::string> overBudget = processImage(options, image, [&](const std::string &color, const std::string &stl) {
+        if (!first) response += ",";
+        first = false;
+        appendModelJson(response, options.format, color, stl);
+    });
+    response += "],\"overBudget\":";
+    response += nlohmann::json(overBudget).dump();
+    response += "}";
+
+    return crow::response(200, std::move(response));
 }
 
 /**
  * @brief handles an image processing request
  * Processes an image processing request. The processing will turn the images into 3d models.
+ * The optional format field picks ascii (default) or binary stl, binary ply or obj for the models,
+ * or 3mf for one 3MF file with every color as its own object instead of json, and mergeFaces
+ * merges the full cells of the top and bottom faces into large rectangles and straight walls into single quads.
+ * maxTriangles decimates every model to that many triangles, as far as it can without moving the outline
+ * by more than an eighth of a pixel; the colors that stay over it are listed in overBudget.
+ * The models are encoded straight into the response body, without a json document in between,
+ * but the body is only sent once every model is done. /api/image_processing/stream sends
+ * every model as soon as it is done.
  * @param request The request to handle.
  * @return The response to the request.
  */
 crow::response Server::handleImageProcessingRequest(const std::string& body) {
-    using json = nlohmann::json;
+    try {
+        UploadedImage upload;
+        ImageProcessingOptions options;
+        if (auto error = parseImageProcessingRequest(imageCache, sessions, body, upload, options)) {
+            return std::move(*error);
+        }
+        return imageProcessingResponse(upload.image, options);
 
+    } catch (const std::exception& e) {
+        return crow::response(400, std::string("Bad request: ") + e.what());
+    }
+}
+
+/**
+ * @brief handles a raw image processing request
+ * Like handleImageProcessingRequest, but the image is uploaded as a file instead of base64 json,
+ * and the colors and format are passed in the query string, X-Colors and X-Format headers or form fields.
+ * @param req The request to handle.
+ * @return The response to the request.
+ */
+crow::response Server::handleRawImageProcessingRequest(const crow::request& req) {
     try {
-        auto parsed = json::parse(body);
+        UploadedImage upload;
+        ImageProcessingOptions options;
+        if (auto error = parseRawImageProcessingRequest(imageCache, sessions, req, upload, options)) {
+            return std::move(*error);
+        }
+        return imageProcessingResponse(upload.image, options);
 
-        std::string base64_img = parsed["image"];
-        std::vector<uchar> raw = base64_decode(base64_img);
+    } catch (const std::exception& e) {
+        return crow::response(400, std::string("Bad request: ") + e.what());
+    }
+}
 
-        cv::Mat image = cv::imdecode(raw, cv::IMREAD_UNCHANGED);
-        if (image.empty()) {
-            return crow::response(400, "Invalid image");
+void StreamPeer::send(std::string &&text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (connection == nullptr) return;
+    sent += text.size();
+    connection->send_text(std::move(text));
+}
+
+void StreamPeer::detach() {
+    std::lock_guard<std::mutex> lock(mutex);
+    connection = nullptr;
+}
+
+bool StreamPeer::isOpen() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return connection != nullptr;
+}
+
+size_t StreamPeer::bytesSent() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sent;
+}
+
+/**
+ * @brief handles an image processing request sent over the stream websocket
+ * Takes the same request as handleImageProcessingRequest, but sends every model as its
+ * own message as soon as it is done, followed by {"done":true,"overBudget":[...]}. A failed request gets
+ * one {"error":...} message. A 3MF file holds all models at once, so it cannot be streamed.
+ * The models that are left are not made once the websocket is closed.
+ * @param request The request to handle.
+ * @param peer The websocket to send the models to.
+ * @return false if the request was rejected or failed.
+ */
+bool Server::handleImageProcessingStream(const std::string& body, StreamPeer &peer) {
+    auto fail = [&](const std::string &message) {
+        peer.send(nlohmann::json{{"error", message}}.dump());
+        return false;
+    };
+    try {
+        UploadedImage upload;
+        ImageProcessingOptions options;
+        if (auto error = parseImageProcessingRequest(imageCache, sessions, body, upload, options)) {
+            return fail(error->body);
         }
-        std::vector<std::string> colors =
-            parsed.value("colors", std::vector<std::string>{});
-
-        auto models = processImage(colors, image);
-        json response;
-        response["models"] = json::array();
-
-        for (const auto& [color, stl_base64] : models) {
-            response["models"].push_back({
-                {"color", color},
-                {"stl", stl_base64}
-            });
+        if (options.format == "3mf") {
+            return fail("3mf cannot be streamed, use /api/image_processing");
         }
 
-        return crow::response(200, response.dump());
+        const std::vector<std::string> overBudget = processImage(options, upload.image, [&](const std::string &color, const std::string &stl) {
+            if (!peer.isOpen()) {
+                throw AsyncJobCancelled();
+            }
+            std::string message;
+            appendModelJson(message, options.format, color, stl);
+            peer.send(std::move(message));
+        });
+        peer.send(nlohmann::json{{"done", true}, {"overBudget", overBudget}}.dump());
+        return true;
 
+    } catch (const AsyncJobCancelled &) {
+        LOG_DEBUG("Stream closed before all models were made");
+        return true;
     } catch (const std::exception& e) {
-        return crow::response(400, std::string("Bad request: ") + e.what());
+        return fail(std::string("Bad request: ") + e.what());
     }
 }
 
+/**
+ * @brief reads the blur mode of a color map request
+ * @param name bilateral, the default edge-preserving blur, or guided, a faster one whose cost does not depend on the blur factor
+ * @return the blur mode
+ * @throws invalid_argument if the name is unknown
+ */
+static BlurMode parseBlurMode(const std::string &name) {
+    if (name == "bilateral") {
+        return BlurMode::Bilateral;
+    }
+    if (name == "guided") {
+        return BlurMode::Guided;
+    }
+    throw std::invalid_argument("Invalid blurMode, expected bilateral or guided");
+}
 
-cv::Mat mapColors(const std::vector<std::string> &colors, bool hsl, int kernelSize, int maxSize, const cv::Mat &image) {
-    ImageHandler imageHandler = ImageHandler();
-    ColorMap colorMap = ColorMap(colors);
-    std::string outputFolder = "/app/output/";
-
-    std::cout << "colors: ";
-    for (const Color &color : colorMap.getColors()) {
-        std::cout << color.getHex() << " ";
+/**
+ * @brief reads the options of a raw color map request
+ * The options are the same as in the json request: colors, method, blurFactor, blurMode, maxSize, removeIslands and minIslandSize.
+ * @param cache the image cache
+ * @param sessions the uploaded images
+ * @param req the request
+ * @param upload output, the decoded image
+ * @param options output, the mapping options
+ * @return an error response if the request is invalid, otherwise nothing
+ */
+static std::optional<crow::response> parseRawColorMapRequest(MatCache &cache, SessionStore &sessions, const crow::request &req,
+                                                             UploadedImage &upload, ColorMapOptions &options) {
+    std::vector<MultipartPart> parts;
+    if (auto error = decodeRawUpload(cache, sessions, req, upload, parts)) {
+        return error;
+    }
+    if (auto colors = getRawParameter(req, parts, "colors", "X-Colors")) {
+        options.colors = splitColors(*colors);
+    }
+    if (auto method = getRawParameter(req, parts, "method", "X-Method")) {
+        options.hsl = *method == "HSL";
+    }
+    if (auto blurFactor = getRawParameter(req, parts, "blurFactor", "X-Blur-Factor")) {
+        options.blurFactor = std::stoi(*blurFactor);
     }
+    if (auto blurMode = getRawParameter(req, parts, "blurMode", "X-Blur-Mode")) {
+        options.blurMode = parseBlurMode(*blurMode);
+    }
+    if (auto maxSize = getRawParameter(req, parts, "maxSize", "X-Max-Size")) {
+        options.maxSize = std::stoi(*maxSize);
+    }
+    options.minIslandSize = readRawIslandOption(req, parts);
+    return std::nullopt;
+}
 
-    imageHandler.setImage(image);
-    if (kernelSize > 0) imageHandler.blurImage(kernelSize);
-    if (maxSize > 0) imageHandler.downScaleImage(maxSize);
-    imageHandler.mapImage(colorMap, hsl);
-    //imageHandler.saveImage(outputFolder + "mapped_image.jpg");
-    // for (int i = 4; i < 5; i++) {
-    //     imageHandler.blurImage(i * 12 + 1);
-    //     imageHandler.mapImage(colorMap);
+/**
+ * @brief maps an image to its palette and encodes it as png
+ * @param cache the image cache
+ * @param upload the decoded image
+ * @param options the mapping options
+ * @return the png bytes
+ */
+static std::vector<uchar> colorMapPng(MatCache &cache, const UploadedImage &upload, const ColorMapOptions &options) {
+    const ImagePipeline pipeline(cache, options);
+    cv::Mat processed = pipeline.run(upload.image, upload.content);
 
-    //     std::string outputFileName = outputFolder + "b_" + std::to_string(i) + "mapped_image.png";
-    //     imageHandler.saveImage(outputFileName);
-    //     std::cout << "Saved " << outputFileName << std::endl;
-    // }
-    return imageHandler.getImage();
+    // Encode processed image to PNG in-memory
+    std::vector<uchar> buf;
+    ScopedTimer timer(Stage::PngEncode);
+    cv::imencode(".png", processed, buf);
+    return buf;
 }
+
 /**
  * @brief handles a color mapping request
  * Processes a color map request and returns a response. These will be used to preview how the image will be split.
@@ -253,26 +984,21 @@ crow::response Server::handleColorMapRequest(const std::string& body) {
 
     try {
         auto parsed = json::parse(body);
-        std::string base64_img = parsed["image"];
-        std::vector<uchar> raw_data = base64_decode(base64_img);
-
-        cv::Mat mat = cv::imdecode(raw_data, cv::IMREAD_UNCHANGED);
-        if (mat.empty()) {
-            return crow::response(400, "Could not decode image");
+        UploadedImage upload;
+        if (auto error = readRequestImage(imageCache, sessions, parsed, upload)) {
+            return std::move(*error);
         }
-        std::vector<std::string> colors = parsed.value("colors", std::vector<std::string>{});
-        std::string method = parsed.value("method", "Euclidian");
-        int kernelSize = parsed.value("blurFactor", 0);
-        int maxSize = parsed.value("maxSize", 1024);
-
-        bool hsl = method == "HSL";
-
-        cv::Mat processed = mapColors(colors, hsl, kernelSize, maxSize,  mat);
+        ColorMapOptions options;
+        options.colors = parsed.value("colors", std::vector<std::string>{});
+        options.hsl = parsed.value("method", "Euclidian") == "HSL";
+        options.blurFactor = parsed.value("blurFactor", 0);
+        options.blurMode = parseBlurMode(parsed.value("blurMode", "bilateral"));
+        options.maxSize = parsed.value("maxSize", 1024);
+        options.minIslandSize = readIslandOption(parsed);
 
-        // Encode processed image to PNG in-memory
-        std::vector<uchar> buf;
-        cv::imencode(".png", processed, buf);
+        std::vector<uchar> buf = colorMapPng(imageCache, upload, options);
 
+        ScopedTimer timer(Stage::ResponseEncode);
         std::string encoded_img = base64_encode(buf.data(), buf.size());
 
         json response_json;
@@ -281,12 +1007,289 @@ crow::response Server::handleColorMapRequest(const std::string& body) {
         return crow::response(200, response_json.dump());
 
     } catch (const std::exception& e) {
-        std::cout << e.what() << std::endl;
+        LOG_WARNING("Bad color map request: ", e.what());
+        return crow::response(400, std::string("Bad request: ") + e.what());
+    }
+}
+
+/**
+ * @brief handles a raw color mapping request
+ * Like handleColorMapRequest, but the image is uploaded as a file and the mapped image
+ * is sent back as a png file, so neither direction goes through base64 json.
+ * @param req The request to handle.
+ * @return The response to the request.
+ */
+crow::response Server::handleRawColorMapRequest(const crow::request& req) {
+    try {
+        UploadedImage upload;
+        ColorMapOptions options;
+        if (auto error = parseRawColorMapRequest(imageCache, sessions, req, upload, options)) {
+            return std::move(*error);
+        }
+
+        std::vector<uchar> buf = colorMapPng(imageCache, upload, options);
+
+        crow::response res(200, std::string(buf.begin(), buf.end()));
+        res.set_header("Content-Type", "image/png");
+        return res;
+
+    } catch (const std::exception& e) {
+        LOG_WARNING("Bad color map request: ", e.what());
+        return crow::response(400, std::string("Bad request: ") + e.what());
+    }
+}
+
+
+
+/**
+ * @brief handles an upload request
+ * Decodes an image and keeps it on the server, so later requests can pass its handle instead of the image.
+ * The image is sent like in the other requests: as the base64 image field of a json body,
+ * or as a raw file or multipart form.
+ * @param req The request to handle.
+ * @return The response with the handle, size and time to live of the image.
+ */
+crow::response Server::handleUploadRequest(const crow::request& req) {
+    using json = nlohmann::json;
+
+    try {
+        UploadedImage upload;
+        const std::string &contentType = req.get_header_value("Content-Type");
+        if (contentType.rfind("application/json", 0) == 0) {
+            auto parsed = json::parse(req.body);
+            if (auto error = readRequestImage(imageCache, sessions, parsed, upload)) {
+                return std::move(*error);
+            }
+        } else {
+            std::vector<MultipartPart> parts;
+            if (auto error = decodeRawUpload(imageCache, sessions, req, upload, parts)) {
+                return std::move(*error);
+            }
+        }
+
+        json response_json;
+        response_json["handle"] = sessions.put(upload);
+        response_json["width"] = upload.image.cols;
+        response_json["height"] = upload.image.rows;
+        response_json["expiresIn"] = sessions.getTtl().count();
+        return crow::response(200, response_json.dump());
+
+    } catch (const std::exception& e) {
         return crow::response(400, std::string("Bad request: ") + e.what());
     }
 }
 
+/**
+ * @brief handles an async job submission
+ * Takes the same request as the image processing endpoints, as json or as a raw upload,
+ * and starts making the models in the background instead of waiting for them.
+ * The request is parsed and its image decoded by the job as well, so a full queue turns
+ * it away before any of that work is done. A request that cannot be read fails the job
+ * with the reason as its error.
+ * @param req The request to handle.
+ * @return 202 with the id of the job, 503 if the scheduler is full.
+ */
+crow::response Server::handleJobSubmitRequest(const crow::request& req) {
+    using json = nlohmann::json;
+
+    try {
+        auto job = asyncJobs.submit([this, req](AsyncJob &job) {
+            UploadedImage upload;
+            ImageProcessingOptions options;
+            const std::string &contentType = req.get_header_value("Content-Type");
+            auto error = contentType.rfind("application/json", 0) == 0
+                ? parseImageProcessingRequest(imageCache, sessions, req.body, upload, options)
+                : parseRawImageProcessingRequest(imageCache, sessions, req, upload, options);
+            if (error) {
+                throw std::invalid_argument(error->body);
+            }
+            job.setRequest(options.colors, options.format);
+            job.setOverBudget(processImage(options, upload.image, [&](const std::string &color, std::string &&stl) {
+                job.addModel(color, std::move(stl));
+                job.checkCancelled();
+            }));
+        });
+        if (!job) {
+            return busyResponse();
+        }
 
+        json response_json;
+        response_json["id"] = job->getId();
+        response_json["status"] = "/api/jobs/" + job->getId();
+        response_json["models"] = "/api/jobs/" + job->getId() + "/models";
+        return crow::response(202, response_json.dump());
+
+    } catch (const std::exception& e) {
+        return crow::response(400, std::string("Bad request: ") + e.what());
+    }
+}
+
+/**
+ * @brief handles an async job status request
+ * @param id The id of the job.
+ * @return The state of the job and which colors have a finished model.
+ */
+crow::response Server::handleJobStatusRequest(const std::string& id) {
+    using json = nlohmann::json;
+
+    std::shared_ptr<AsyncJob> job = asyncJobs.find(id);
+    if (!job) {
+        return crow::response(404, "Unknown or expired job");
+    }
+    const AsyncJob::Status status = job->getStatus();
+
+    json response_json;
+    response_json["id"] = id;
+    response_json["state"] = AsyncJob::stateName(status.state);
+    response_json["format"] = job->getFormat();
+    response_json["modelsDone"] = status.modelsDone;
+    response_json["modelsTotal"] = status.modelsTotal;
+    const std::vector<std::string> jobColors = job->getColors();
+    json colors = json::array();
+    for (size_t i = 0; i < jobColors.size(); i++) {
+        colors.push_back({{"color", jobColors[i]}, {"done", i < status.modelsDone}});
+    }
+    response_json["colors"] = colors;
+    response_json["overBudget"] = job->getOverBudget();
+    if (status.state == AsyncJob::State::Failed) {
+        response_json["error"] = status.error;
+    }
+    return crow::response(200, response_json.dump());
+}
+
+/**
+ * @brief handles a request for all models of an async job
+ * A 3mf job keeps the mesh element of every model and packs them into one file here.
+ * @param id The id of the job.
+ * @return The same response as the image processing endpoint once the job is done, 409 before that.
+ */
+crow::response Server::handleJobModelsRequest(const std::string& id) {
+    std::shared_ptr<AsyncJob> job = asyncJobs.find(id);
+    if (!job) {
+        return crow::response(404, "Unknown or expired job");
+    }
+    const AsyncJob::Status status = job->getStatus();
+    if (status.state != AsyncJob::State::Done) {
+        return crow::response(409, std::string("Job is ") + AsyncJob::stateName(status.state));
+    }
+
+    const std::string format = job->getFormat();
+    if (format == "3mf") {
+        std::vector<ThreeMFObject> objects;
+        for (size_t i = 0; i < status.modelsDone; i++) {
+            const AsyncJob::Model *model = job->getModel(i);
+            objects.push_back({model->color, model->data});
+        }
+        crow::response res = packageResponse(objects);
+        setOverBudgetHeader(res, job->getOverBudget());
+        return res;
+    }
+
+    std::string response = "{\"format\":\"" + format + "\",\"models\":[";
+    for (size_t i = 0; i < status.modelsDone; i++) {
+        const AsyncJob::Model *model = job->getModel(i);
+        if (i > 0) response += ",";
+        appendModelJson(response, format, model->color, model->data);
+    }
+    response += "],\"overBudget\":";
+    response += nlohmann::json(job->getOverBudget()).dump();
+    response += "}";
+    return crow::response(200, std::move(response));
+}
+
+/**
+ * @brief handles a request for one model of an async job
+ * A model can be downloaded as soon as it is finished, before the rest of the job is done.
+ * @param id The id of the job.
+ * @param index The index of the color in the request.
+ * @return The model file, a 3MF file with only this model for a 3mf job, 409 if it is not finished yet.
+ */
+crow::response Server::handleJobModelRequest(const std::string& id, int index) {
+    std::shared_ptr<AsyncJob> job = asyncJobs.find(id);
+    if (!job) {
+        return crow::response(404, "Unknown or expired job");
+    }
+    // the colors are only known once the job has read its request
+    const size_t colorCount = job->getColors().size();
+    if (index < 0 || ((colorCount > 0 || job->isFinished()) && static_cast<size_t>(index) >= colorCount)) {
+        return crow::response(404, "No model with that index");
+    }
+    const AsyncJob::Model *model = job->getModel(index);
+    if (!model) {
+        return crow::response(409, "Model is not finished yet");
+    }
+
+    const std::string format = job->getFormat();
+    if (format == "3mf") {
+        return packageResponse({{model->color, model->data}});
+    }
+    crow::response res(200, model->data);
+    res.set_header("Content-Type", format == "binary" || format == "ply" ? "application/octet-stream" : "text/plain");
+    return res;
+}
+
+/**
+ * @brief handles a metrics request
+ * @return The stage and request metrics, the queue depth and the cache and session sizes, in the Prometheus text format.
+ */
+crow::response Server::handleMetricsRequest() {
+    std::string text = metrics().render();
+    auto append = [&](const char *name, const char *type, const char *help, uint64_t value) {
+        text += std::string("# HELP ") + name + " " + help + "\n";
+        text += std::string("# TYPE ") + name + " " + type + "\n";
+        text += std::string(name) + " " + std::to_string(value) + "\n";
+    };
+    append("colormap_jobs_queued", "gauge", "Requests waiting for a worker.", scheduler.getQueued());
+    append("colormap_jobs_running", "gauge", "Requests being processed by a worker.", scheduler.getRunning());
+    append("colormap_jobs_rejected_total", "counter", "Requests turned away because the queue was full.", scheduler.getRejected());
+    append("colormap_async_jobs", "gauge", "Async jobs that are kept, running or finished.", asyncJobs.getJobs());
+    append("colormap_async_job_bytes", "gauge", "Memory held by the models of async jobs.", asyncJobs.getBytes());
+    append("colormap_palette_table_bytes", "gauge", "Memory held by the cached palette lookup tables.", PaletteLookup::getCacheBytes());
+    append("colormap_cache_hits_total", "counter", "Image cache hits.", imageCache.getHits());
+    append("colormap_cache_misses_total", "counter", "Image cache misses.", imageCache.getMisses());
+    append("colormap_cache_bytes", "gauge", "Pixel memory held by the image cache.", imageCache.getBytes());
+    append("colormap_sessions", "gauge", "Uploaded images kept under a handle.", sessions.getSessions());
+    append("colormap_session_bytes", "gauge", "Pixel memory held by uploaded images.", sessions.getBytes());
+    append("colormap_log_dropped_total", "counter", "Log messages dropped because the log buffer was full.", logger().getDropped());
+
+    crow::response res(200, std::move(text));
+    res.set_header("Content-Type", "text/plain; version=0.0.4");
+    return res;
+}
+
+/**
+ * @brief handles a log level request
+ * A GET returns the level, a POST with {"level": "debug"} changes it. The levels are
+ * debug, info, warning, error and off. Changing the level is off unless the server was
+ * started with logLevelControl, and the POST must be sent as application/json, which a
+ * page on another origin cannot do without a preflight the CORS middleware does not answer.
+ * @param req The request to handle.
+ * @return The level after the request, and the number of messages dropped because the log buffer was full.
+ */
+crow::response Server::handleLogLevelRequest(const crow::request &req) {
+    if (req.method == crow::HTTPMethod::Post) {
+        if (!logLevelControl) {
+            return crow::response(403, "Changing the log level is disabled");
+        }
+        if (req.get_header_value("Content-Type").rfind("application/json", 0) != 0) {
+            return crow::response(415, "Expected application/json");
+        }
+        nlohmann::json parsed = nlohmann::json::parse(req.body, nullptr, false);
+        if (parsed.is_discarded() || !parsed.contains("level") || !parsed["level"].is_string()) {
+            return crow::response(400, "Bad request: expected {\"level\": \"debug|info|warning|error|off\"}");
+        }
+        std::optional<LogLevel> level = Logger::parseLevel(parsed["level"].get<std::string>());
+        if (!level) {
+            return crow::response(400, "Bad request: unknown log level");
+        }
+        setLogLevel(*level);
+        LOG_INFO("Log level set to ", Logger::levelName(*level));
+    }
+    nlohmann::json response;
+    response["level"] = Logger::levelName(logger().getLevel());
+    response["dropped"] = logger().getDropped();
+    return crow::response(200, response.dump());
+}
 
 /**
  * @brief Gets colors from mapping request
@@ -295,7 +1298,7 @@ crow::response Server::handleColorMapRequest(const std::string& body) {
  * @return A vector of colors extracted from the request.
  */
 std::vector<std::string> Server::getColorsFromMappingRequest(const std::string &request) const {
-    std::cout << "Extracting colors from request: " << request << std::endl;
+    (void)request;
     return {};
      // TODO: Implement actual extraction logic
 }
@@ -0,0 +1,105 @@
+#include "../header/SessionStore.hpp"
+#include "../header/RandomId.hpp"
+#include <stdexcept>
+
+/**
+ * @brief Constructor of the store
+ * @param capBytes The most pixel memory the stored images may take
+ * @param ttl How long an image is kept after it was last used
+ */
+SessionStore::SessionStore(size_t capBytes, std::chrono::seconds ttl)
+    : capBytes(capBytes), ttl(ttl) {}
+
+/**
+ * @brief Store an uploaded image
+ * @param upload The decoded image, shared with the store
+ * @return The handle of the image
+ * @throws invalid_argument If the image is empty or larger than the whole memory cap
+ */
+std::string SessionStore::put(const UploadedImage &upload) {
+    const size_t size = upload.image.total() * upload.image.elemSize();
+    if (size == 0) {
+        throw std::invalid_argument("Cannot store an empty image");
+    }
+    if (size > capBytes) {
+        throw std::invalid_argument("Image is too large to store");
+    }
+
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string handle = newHandle();
+    sessions.push_front({handle, upload, size, now});
+    index[handle] = sessions.begin();
+    bytes += size;
+    evict(now);
+    return handle;
+}
+
+/**
+ * @brief Look up an image and renew its time to live
+ * @param handle The handle from put
+ * @return The image, or nothing if the handle is unknown or expired
+ */
+std::optional<UploadedImage> SessionStore::get(const std::string &handle) {
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    evict(now);
+    auto it = index.find(handle);
+    if (it == index.end()) {
+        return std::nullopt;
+    }
+    it->second->lastUsed = now;
+    sessions.splice(sessions.begin(), sessions, it->second);
+    return it->second->upload;
+}
+
+/**
+ * @brief Drop an image before it expires
+ * @param handle The handle from put
+ * @return True if the handle was known
+ */
+bool SessionStore::remove(const std::string &handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(handle);
+    if (it == index.end()) {
+        return false;
+    }
+    bytes -= it->second->bytes;
+    sessions.erase(it->second);
+    index.erase(it);
+    return true;
+}
+
+size_t SessionStore::getBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+size_t SessionStore::getSessions() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sessions.size();
+}
+
+/**
+ * @brief Makes a random 128 bit handle that is not in use, the lock must be held
+ */
+std::string SessionStore::newHandle() {
+    std::string handle;
+    do {
+        handle = makeRandomId();
+    } while (index.count(handle));
+    return handle;
+}
+
+/**
+ * @brief Drops expired images and, while over the memory cap, the least recently used ones
+ * The list is ordered by last use, so both are found at its back. The lock must be held.
+ * @param now The current time
+ */
+void SessionStore::evict(Clock::time_point now) {
+    while (!sessions.empty() && (bytes > capBytes || now - sessions.back().lastUsed > ttl)) {
+        bytes -= sessions.back().bytes;
+        index.erase(sessions.back().handle);
+        sessions.pop_back();
+    }
+}
@@ -0,0 +1,197 @@
+#include "../header/ThreeMF.hpp"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <zlib.h>
+#include "../header/Color.hpp"
+
+namespace {
+
+/**
+ * @brief Writes the files of a zip archive one after the other
+ * Every file is deflated and followed by nothing, the sizes and crc are known before
+ * its header is written. The archive ends with the central directory.
+ */
+class ZipWriter {
+  public:
+    void add(const std::string &name, const std::string &data);
+    std::string finish();
+
+  private:
+    struct Entry {
+        std::string name;
+        uint32_t crc;
+        uint32_t compressedSize;
+        uint32_t size;
+        uint32_t offset;
+    };
+
+    std::string out;
+    std::vector<Entry> entries;
+
+    void put16(uint16_t value);
+    void put32(uint32_t value);
+};
+
+// 1980-01-01 00:00 as a dos date and time, zip files cannot store an earlier one
+constexpr uint16_t dosDate = (1 << 5) | 1;
+constexpr uint16_t dosTime = 0;
+constexpr uint16_t zipVersion = 20;
+constexpr uint16_t deflated = 8;
+
+void ZipWriter::put16(uint16_t value) {
+    out.push_back(static_cast<char>(value & 0xff));
+    out.push_back(static_cast<char>(value >> 8));
+}
+
+void ZipWriter::put32(uint32_t value) {
+    put16(static_cast<uint16_t>(value & 0xffff));
+    put16(static_cast<uint16_t>(value >> 16));
+}
+
+/**
+ * @brief Checks that a size fits in the 32 bit fields of a zip file
+ */
+uint32_t zipSize(size_t size) {
+    if (size > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("3MF part is too large");
+    }
+    return static_cast<uint32_t>(size);
+}
+
+/**
+ * @brief Deflates data without a zlib header, as zip files store it
+ * The fastest level is used, the xml of a model still shrinks several times.
+ */
+std::string deflateRaw(const std::string &data) {
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Cannot start deflate");
+    }
+    std::string compressed(deflateBound(&stream, zipSize(data.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    const int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error("Cannot deflate 3MF part");
+    }
+    compressed.resize(stream.total_out);
+    return compressed;
+}
+
+void ZipWriter::add(const std::string &name, const std::string &data) {
+    const std::string compressed = deflateRaw(data);
+    Entry entry{name,
+                static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef *>(data.data()), static_cast<uInt>(data.size()))),
+                zipSize(compressed.size()), zipSize(data.size()), zipSize(out.size())};
+
+    put32(0x04034b50);
+    put16(zipVersion);
+    put16(0);
+    put16(deflated);
+    put16(dosTime);
+    put16(dosDate);
+    put32(entry.crc);
+    put32(entry.compressedSize);
+    put32(entry.size);
+    put16(static_cast<uint16_t>(name.size()));
+    put16(0);
+    out += name;
+    out += compressed;
+    entries.push_back(std::move(entry));
+}
+
+std::string ZipWriter::finish() {
+    const uint32_t directoryOffset = zipSize(out.size());
+    for (const Entry &entry : entries) {
+        put32(0x02014b50);
+        put16(zipVersion);
+        put16(zipVersion);
+        put16(0);
+        put16(deflated);
+        put16(dosTime);
+        put16(dosDate);
+        put32(entry.crc);
+        put32(entry.compressedSize);
+        put32(entry.size);
+        put16(static_cast<uint16_t>(entry.name.size()));
+        put16(0);
+        put16(0);
+        put16(0);
+        put16(0);
+        put32(0);
+        put32(entry.offset);
+        out += entry.name;
+    }
+    const uint32_t directorySize = zipSize(out.size()) - directoryOffset;
+
+    put32(0x06054b50);
+    put16(0);
+    put16(0);
+    put16(static_cast<uint16_t>(entries.size()));
+    put16(static_cast<uint16_t>(entries.size()));
+    put32(directorySize);
+    put32(directoryOffset);
+    put16(0);
+    return std::move(out);
+}
+
+const char contentTypes[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">\n"
+    "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>\n"
+    "<Default Extension=\"model\" ContentType=\"application/vnd.ms-package.3dmanufacturing-3dmodel+xml\"/>\n"
+    "</Types>\n";
+
+const char relationships[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">\n"
+    "<Relationship Target=\"/3D/3dmodel.model\" Id=\"rel0\" "
+    "Type=\"http://schemas.microsoft.com/3dmanufacturing/2013/01/3dmodel\"/>\n"
+    "</Relationships>\n";
+
+} // namespace
+
+std::string make3MFPackage(const std::vector<ThreeMFObject> &objects) {
+    // the colors go through Color, so only valid hex ends up in the xml
+    std::vector<std::string> colors;
+    std::vector<const ThreeMFObject *> used;
+    for (const ThreeMFObject &object : objects) {
+        if (object.mesh.empty()) continue;
+        colors.push_back(Color(object.color).getHex());
+        used.push_back(&object);
+    }
+
+    std::string model =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<model unit=\"millimeter\" xml:lang=\"en-US\" xmlns=\"http://schemas.microsoft.com/3dmanufacturing/core/2015/02\">\n"
+        "<resources>\n";
+    if (!used.empty()) {
+        model += "<basematerials id=\"1\">\n";
+        for (const std::string &color : colors) {
+            model += "<base name=\"" + color + "\" displaycolor=\"" + color + "\"/>\n";
+        }
+        model += "</basematerials>\n";
+    }
+    // id 1 is the base materials, the objects follow
+    for (size_t i = 0; i < used.size(); i++) {
+        model += "<object id=\"" + std::to_string(i + 2) + "\" type=\"model\" name=\"" + colors[i] +
+                 "\" pid=\"1\" pindex=\"" + std::to_string(i) + "\">\n";
+        model += used[i]->mesh;
+        model += "</object>\n";
+    }
+    model += "</resources>\n<build>\n";
+    for (size_t i = 0; i < used.size(); i++) {
+        model += "<item objectid=\"" + std::to_string(i + 2) + "\"/>\n";
+    }
+    model += "</build>\n</model>\n";
+
+    ZipWriter zip;
+    zip.add("[Content_Types].xml", contentTypes);
+    zip.add("_rels/.rels", relationships);
+    zip.add("3D/3dmodel.model", model);
+    return zip.finish();
+}
@@ -0,0 +1,402 @@
+#include "../header/Triangulate.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+
+namespace {
+
+constexpr double fullTurn = 6.283185307179586;
+
+enum class VertexType : uint8_t { Start, End, Split, Merge, Regular };
+
+/**
+ * @brief The working state of one triangulation
+ * Every corner knows its neighbors on its ring, so the rings run counter clockwise
+ * around the inside: the outer ring counter clockwise and the holes clockwise.
+ */
+class Triangulator {
+  public:
+    Triangulator(const std::vector<GridPoint> &points, const std::vector<uint32_t> &ringStarts,
+                 std::vector<std::array<uint32_t, 3>> &triangles)
+        : points(points), ringStarts(ringStarts), triangles(triangles), status(EdgeOrder{this}) {}
+    void run();
+
+  private:
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    /**
+     * @brief Orders the edges in the status from left to right at the sweep line
+     * An edge is named by the corner it starts at. Edges never cross, so the order
+     * stays the same while they are in the status.
+     */
+    struct EdgeOrder {
+        const Triangulator *t;
+        using is_transparent = void;
+        bool operator()(uint32_t a, uint32_t b) const { return t->edgeBefore(a, b); }
+        bool operator()(uint32_t a, const GridPoint &p) const { return t->edgeLeftOf(a, p); }
+        bool operator()(const GridPoint &p, uint32_t a) const { return !t->edgeLeftOf(a, p); }
+    };
+    using Status = std::set<uint32_t, EdgeOrder>;
+
+    const std::vector<GridPoint> &points;
+    const std::vector<uint32_t> &ringStarts;
+    std::vector<std::array<uint32_t, 3>> &triangles;
+
+    std::vector<uint32_t> prev, next;
+    std::vector<VertexType> types;
+    std::vector<uint32_t> helper;
+    std::vector<std::pair<uint32_t, uint32_t>> diagonals;
+    Status status;
+    std::vector<Status::iterator> positions;
+    int64_t sweepY = 0;
+
+    bool above(uint32_t a, uint32_t b) const {
+        return points[a][1] > points[b][1] || (points[a][1] == points[b][1] && points[a][0] < points[b][0]);
+    }
+    int64_t cross(uint32_t a, uint32_t b, uint32_t c) const {
+        return (static_cast<int64_t>(points[b][0]) - points[a][0]) * (static_cast<int64_t>(points[c][1]) - points[a][1]) -
+               (static_cast<int64_t>(points[b][1]) - points[a][1]) * (static_cast<int64_t>(points[c][0]) - points[a][0]);
+    }
+
+    void xAt(uint32_t edge, int64_t y, int64_t &num, int64_t &den) const;
+    bool edgeBefore(uint32_t a, uint32_t b) const;
+    bool edgeLeftOf(uint32_t edge, const GridPoint &p) const;
+
+    void link();
+    void sweep();
+    uint32_t leftOf(uint32_t v) const;
+    void insertEdge(uint32_t v);
+    void eraseEdge(uint32_t edge);
+    void connectMerge(uint32_t v, uint32_t edge);
+    void splitFaces();
+    void triangulateMonotone(const std::vector<uint32_t> &face);
+};
+
+/**
+ * @brief The x of an edge at the height y, as the fraction num / den with den > 0
+ * A horizontal edge is at its left end.
+ */
+void Triangulator::xAt(uint32_t edge, int64_t y, int64_t &num, int64_t &den) const {
+    const int64_t x1 = points[edge][0], y1 = points[edge][1];
+    const int64_t x2 = points[next[edge]][0], y2 = points[next[edge]][1];
+    if (y1 == y2) {
+        num = std::min(x1, x2);
+        den = 1;
+        return;
+    }
+    den = y2 - y1;
+    num = x1 * den + (y - y1) * (x2 - x1);
+    if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+}
+
+bool Triangulator::edgeBefore(uint32_t a, uint32_t b) const {
+    if (a == b) return false;
+    int64_t na, da, nb, db;
+    xAt(a, sweepY, na, da);
+    xAt(b, sweepY, nb, db);
+    if (na * db != nb * da) return na * db < nb * da;
+    // edges that meet at the sweep line are ordered by where they go below it
+    xAt(a, sweepY - 1, na, da);
+    xAt(b, sweepY - 1, nb, db);
+    if (na * db != nb * da) return na * db < nb * da;
+    return a < b;
+}
+
+bool Triangulator::edgeLeftOf(uint32_t edge, const GridPoint &p) const {
+    int64_t num, den;
+    xAt(edge, p[1], num, den);
+    return num < p[0] * den;
+}
+
+/**
+ * @brief Links the corners of every ring, turning rings that run the wrong way around
+ */
+void Triangulator::link() {
+    const size_t n = points.size();
+    prev.assign(n, none);
+    next.assign(n, none);
+    for (size_t r = 0; r < ringStarts.size(); r++) {
+        const size_t start = ringStarts[r];
+        const size_t end = r + 1 < ringStarts.size() ? ringStarts[r + 1] : n;
+        if (end - start < 3) continue;
+        int64_t sum = 0;
+        for (size_t i = start, j = end - 1; i < end; j = i++) {
+            sum += static_cast<int64_t>(points[j][0]) * points[i][1] - static_cast<int64_t>(points[i][0]) * points[j][1];
+        }
+        const bool forward = (r == 0) == (sum > 0);
+        for (size_t i = start; i < end; i++) {
+            const uint32_t after = static_cast<uint32_t>(i + 1 < end ? i + 1 : start);
+            const uint32_t before = static_cast<uint32_t>(i > start ? i - 1 : end - 1);
+            next[i] = forward ? after : before;
+            prev[i] = forward ? before : after;
+        }
+    }
+}
+
+/**
+ * @brief Finds the edge of the status that is directly left of a corner
+ */
+uint32_t Triangulator::leftOf(uint32_t v) const {
+    auto it = status.lower_bound(points[v]);
+    if (it == status.begin()) return none;
+    return *--it;
+}
+
+void Triangulator::insertEdge(uint32_t v) {
+    positions[v] = status.insert(v).first;
+    helper[v] = v;
+}
+
+void Triangulator::eraseEdge(uint32_t edge) {
+    if (positions[edge] != status.end()) {
+        status.erase(positions[edge]);
+        positions[edge] = status.end();
+    }
+}
+
+/**
+ * @brief Connects a corner to the helper of an edge if that helper is a merge corner
+ */
+void Triangulator::connectMerge(uint32_t v, uint32_t edge) {
+    if (edge != none && helper[edge] != none && types[helper[edge]] == VertexType::Merge) {
+        diagonals.emplace_back(v, helper[edge]);
+    }
+}
+
+/**
+ * @brief Splits the polygon into y-monotone pieces with a sweep from top to bottom
+ * The status holds the edges with the inside on their right, each with its helper:
+ * the lowest corner above the sweep line that can see it. Split corners are connected
+ * up to a helper and merge corners down to the next corner that takes over from them.
+ */
+void Triangulator::sweep() {
+    const size_t n = points.size();
+    types.assign(n, VertexType::Regular);
+    helper.assign(n, none);
+    positions.assign(n, status.end());
+
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    for (uint32_t v = 0; v < n; v++) {
+        if (next[v] == none) continue;
+        order.push_back(v);
+        const bool prevBelow = above(v, prev[v]);
+        const bool nextBelow = above(v, next[v]);
+        const bool convex = cross(prev[v], v, next[v]) > 0;
+        if (prevBelow && nextBelow) {
+            types[v] = convex ? VertexType::Start : VertexType::Split;
+        } else if (!prevBelow && !nextBelow) {
+            types[v] = convex ? VertexType::End : VertexType::Merge;
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return above(a, b); });
+
+    for (const uint32_t v : order) {
+        sweepY = points[v][1];
+        const uint32_t incoming = prev[v];
+        switch (types[v]) {
+            case VertexType::Start:
+                insertEdge(v);
+                break;
+            case VertexType::End:
+                connectMerge(v, incoming);
+                eraseEdge(incoming);
+                break;
+            case VertexType::Split: {
+                const uint32_t left = leftOf(v);
+                if (left != none) {
+                    diagonals.emplace_back(v, helper[left]);
+                    helper[left] = v;
+                }
+                insertEdge(v);
+                break;
+            }
+            case VertexType::Merge: {
+                connectMerge(v, incoming);
+                eraseEdge(incoming);
+                const uint32_t left = leftOf(v);
+                if (left != none) {
+                    connectMerge(v, left);
+                    helper[left] = v;
+                }
+                break;
+            }
+            case VertexType::Regular:
+                if (above(incoming, v)) {
+                    // the inside is on the right of the corner
+                    connectMerge(v, incoming);
+                    eraseEdge(incoming);
+                    insertEdge(v);
+                } else {
+                    const uint32_t left = leftOf(v);
+                    if (left != none) {
+                        connectMerge(v, left);
+                        helper[left] = v;
+                    }
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Walks the pieces between the edges and diagonals and triangulates each one
+ * A piece is followed counter clockwise, at every corner taking the first way out
+ * clockwise from the way in.
+ */
+void Triangulator::splitFaces() {
+    const size_t n = points.size();
+    // the diagonals as half edges, grouped by the corner they start at
+    std::vector<uint32_t> offsets(n + 1, 0);
+    for (const auto &[a, b] : diagonals) {
+        offsets[a + 1]++;
+        offsets[b + 1]++;
+    }
+    for (size_t v = 0; v < n; v++) offsets[v + 1] += offsets[v];
+    std::vector<uint32_t> targets(offsets[n]);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (const auto &[a, b] : diagonals) {
+        targets[fill[a]++] = b;
+        targets[fill[b]++] = a;
+    }
+    std::vector<uint8_t> edgeUsed(n, 0);
+    std::vector<uint8_t> diagonalUsed(targets.size(), 0);
+
+    // a half edge is its start and slot, slot none being the edge of the ring
+    const auto target = [&](uint32_t from, uint32_t slot) { return slot == none ? next[from] : targets[slot]; };
+    const auto used = [&](uint32_t from, uint32_t slot) -> uint8_t & {
+        return slot == none ? edgeUsed[from] : diagonalUsed[slot];
+    };
+    const auto turn = [&](uint32_t from, uint32_t v) {
+        if (offsets[v] == offsets[v + 1]) return none;
+        const double back = std::atan2(static_cast<double>(points[from][1] - points[v][1]),
+                                       static_cast<double>(points[from][0] - points[v][0]));
+        uint32_t best = none;
+        double bestAngle = 7;
+        for (uint32_t slot = offsets[v]; slot <= offsets[v + 1]; slot++) {
+            const uint32_t s = slot == offsets[v + 1] ? none : slot;
+            const uint32_t to = target(v, s);
+            double angle = back - std::atan2(static_cast<double>(points[to][1] - points[v][1]),
+                                             static_cast<double>(points[to][0] - points[v][0]));
+            while (angle <= 0) angle += fullTurn;
+            while (angle > fullTurn) angle -= fullTurn;
+            if (angle < bestAngle) {
+                bestAngle = angle;
+                best = s;
+            }
+        }
+        return best;
+    };
+
+    std::vector<uint32_t> face;
+    const auto walk = [&](uint32_t from, uint32_t slot) {
+        face.clear();
+        while (!used(from, slot)) {
+            used(from, slot) = 1;
+            face.push_back(from);
+            const uint32_t to = target(from, slot);
+            slot = turn(from, to);
+            from = to;
+        }
+        triangulateMonotone(face);
+    };
+    for (uint32_t v = 0; v < n; v++) {
+        if (next[v] != none && !edgeUsed[v]) walk(v, none);
+    }
+    for (uint32_t v = 0; v < n; v++) {
+        for (uint32_t slot = offsets[v]; slot < offsets[v + 1]; slot++) {
+            if (!diagonalUsed[slot]) walk(v, slot);
+        }
+    }
+}
+
+/**
+ * @brief Triangulates a y-monotone piece, given counter clockwise
+ * The corners are visited from top to bottom. The stack holds the corners that are
+ * not triangulated yet, which form a reflex chain on one side of the piece.
+ */
+void Triangulator::triangulateMonotone(const std::vector<uint32_t> &face) {
+    const size_t n = face.size();
+    if (n < 3) return;
+    if (n == 3) {
+        triangles.push_back({face[0], face[1], face[2]});
+        return;
+    }
+    size_t top = 0, bottom = 0;
+    for (size_t i = 1; i < n; i++) {
+        if (above(face[i], face[top])) top = i;
+        if (above(face[bottom], face[i])) bottom = i;
+    }
+    // counter clockwise from the top down to the bottom is the left chain
+    std::vector<uint8_t> left(n, 0);
+    for (size_t i = top; i != bottom; i = (i + 1) % n) left[i] = 1;
+
+    std::vector<size_t> sorted(n);
+    for (size_t i = 0; i < n; i++) sorted[i] = i;
+    std::sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) { return above(face[a], face[b]); });
+
+    // a triangle between a corner of the stack chain, the corner above it on the stack and u
+    const auto fan = [&](size_t a, size_t b, size_t u) {
+        if (left[a]) {
+            triangles.push_back({face[b], face[a], face[u]});
+        } else {
+            triangles.push_back({face[a], face[b], face[u]});
+        }
+    };
+
+    std::vector<size_t> stack = {sorted[0], sorted[1]};
+    for (size_t j = 2; j + 1 < n; j++) {
+        const size_t u = sorted[j];
+        if (left[u] != left[stack.back()]) {
+            while (stack.size() > 1) {
+                const size_t a = stack.back();
+                stack.pop_back();
+                fan(a, stack.back(), u);
+            }
+            stack.clear();
+            stack.push_back(sorted[j - 1]);
+            stack.push_back(u);
+        } else {
+            size_t last = stack.back();
+            stack.pop_back();
+            while (!stack.empty()) {
+                const size_t t = stack.back();
+                const bool inside = left[u] ? cross(face[t], face[last], face[u]) > 0 : cross(face[u], face[last], face[t]) > 0;
+                if (!inside) break;
+                if (left[u]) {
+                    triangles.push_back({face[t], face[last], face[u]});
+                } else {
+                    triangles.push_back({face[u], face[last], face[t]});
+                }
+                last = t;
+                stack.pop_back();
+            }
+            stack.push_back(last);
+            stack.push_back(u);
+        }
+    }
+    const size_t u = sorted[n - 1];
+    while (stack.size() > 1) {
+        const size_t a = stack.back();
+        stack.pop_back();
+        fan(a, stack.back(), u);
+    }
+}
+
+void Triangulator::run() {
+    if (ringStarts.empty() || points.size() < 3) return;
+    link();
+    sweep();
+    splitFaces();
+}
+
+} // namespace
+
+void triangulatePolygon(const std::vector<GridPoint> &points, const std::vector<uint32_t> &ringStarts,
+                        std::vector<std::array<uint32_t, 3>> &triangles) {
+    Triangulator(points, ringStarts, triangles).run();
+}